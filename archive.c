@@ -0,0 +1,677 @@
+/**
+ * Delta encoded EEPROM images archive
+ *
+ * Copyright (c) 2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Units of a lot differ from the lot golden image only in a few words (MAC
+ * address, frequency offset, some power values), so each image is stored
+ * as a sparse word level delta against a baseline image of the same chip ID
+ * and EEPROM version.
+ *
+ * Archive file layout (all numbers are little endian):
+ *   magic "MTKEEPAR"
+ *   records, each one starts with a header:
+ *     u8  type ('B' - baseline, 'D' - delta)
+ *     u8  name length
+ *     u16 image length, bytes
+ *     u16 chip ID
+ *     u16 EEPROM version
+ *     u16 baseline index (delta only)
+ *     u16 number of runs (delta only)
+ *   followed by the name and the payload:
+ *     baseline - image data
+ *     delta - runs of changed words: u16 word offset, u16 number of words,
+ *             words data as they are stored in the image
+ *
+ * Baseline bytes beyond its length are treated as 0xff (blank EEPROM).
+ * Images are stored exactly as they are read, an odd sized image has its
+ * last word padded with 0xff. Image names are file base names, which are
+ * made unique within the archive by a "~N" suffix, and could not contain
+ * '/', so extraction never leaves the target directory.
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <stdint.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mtkeepmgr.h"
+#include "corpus.h"
+
+#define ARCH_MAGIC		"MTKEEPAR"
+#define ARCH_MAGIC_LEN		8
+#define ARCH_HDR_LEN		12
+
+#define ARCH_REC_BASE		'B'
+#define ARCH_REC_DELTA		'D'
+
+/* Unchanged words gap, which is cheaper to store than a new run header */
+#define ARCH_RUN_GAP_MAX	2
+
+#define ARCH_EEP_SZ		sizeof(((struct main_ctx *)0)->eep_buf)
+
+struct arch_base {
+	const uint8_t *data;
+	uint8_t *buf;			/* Data of a just added baseline */
+	unsigned len;
+	uint16_t chipid;
+	uint16_t version;
+};
+
+struct arch_delta {
+	char name[0x100];
+	unsigned base;			/* Baseline index */
+	unsigned len;
+	unsigned nruns;
+	const uint8_t *runs;
+};
+
+struct arch {
+	uint8_t *map;			/* Mapped archive file */
+	size_t mapsz;
+	struct arch_base *bases;
+	unsigned nbases;
+	struct arch_delta *deltas;
+	unsigned ndeltas;
+};
+
+static inline unsigned get_le16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static inline uint8_t *put_le16(uint8_t *p, unsigned val)
+{
+	p[0] = val;
+	p[1] = val >> 8;
+
+	return p + 2;
+}
+
+/* Names of archived images, an open addressing hash set */
+struct arch_names {
+	char **slots;
+	unsigned mask;
+};
+
+static void *arch_grow(void *arr, unsigned n, size_t sz)
+{
+	/* Grow by power of two steps */
+	if (n & (n - 1))
+		return arr;
+
+	return realloc(arr, (n ? n * 2 : 1) * sz);
+}
+
+/* Image name should be usable as a file name inside the target directory */
+static int arch_name_valid(const uint8_t *name, unsigned len)
+{
+	if (!len || memchr(name, '/', len) || memchr(name, '\0', len))
+		return 0;
+	if ((len == 1 && name[0] == '.') ||
+	    (len == 2 && name[0] == '.' && name[1] == '.'))
+		return 0;
+
+	return 1;
+}
+
+/* Index the whole archive, a missing archive file is treated as empty */
+static int arch_open(struct arch *a, const char *fname)
+{
+	const uint8_t *p, *e, *name;
+	struct arch_delta *d;
+	struct arch_base *b;
+	unsigned i, cnt;
+	struct stat st;
+	void *tmp;
+	int fd;
+
+	memset(a, 0x00, sizeof(*a));
+
+	fd = open(fname, O_RDONLY);
+	if (fd == -1 && errno == ENOENT)
+		return 0;
+	if (fd == -1 || fstat(fd, &st)) {
+		fprintf(stderr, "archive: unable to open '%s': %s\n", fname,
+			strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return -EIO;
+	}
+	if (!st.st_size) {
+		close(fd);
+		return 0;
+	}
+
+	a->mapsz = st.st_size;
+	a->map = mmap(NULL, a->mapsz, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (a->map == MAP_FAILED) {
+		fprintf(stderr, "archive: unable to map '%s': %s\n", fname,
+			strerror(errno));
+		a->map = NULL;
+		return -EIO;
+	}
+
+	p = a->map;
+	e = a->map + a->mapsz;
+	if (a->mapsz < ARCH_MAGIC_LEN ||
+	    memcmp(p, ARCH_MAGIC, ARCH_MAGIC_LEN) != 0) {
+		fprintf(stderr, "archive: '%s' is not an EEPROM archive\n",
+			fname);
+		return -EINVAL;
+	}
+
+	for (p += ARCH_MAGIC_LEN; p < e;) {
+		if (e - p < ARCH_HDR_LEN || e - p < ARCH_HDR_LEN + p[1])
+			goto corrupted;
+		name = p + ARCH_HDR_LEN;
+
+		if (p[0] == ARCH_REC_BASE) {
+			tmp = arch_grow(a->bases, a->nbases, sizeof(*b));
+			if (!tmp)
+				return -ENOMEM;
+			a->bases = tmp;
+			b = &a->bases[a->nbases++];
+			b->buf = NULL;
+			b->len = get_le16(p + 2);
+			b->chipid = get_le16(p + 4);
+			b->version = get_le16(p + 6);
+			b->data = name + p[1];
+			if (b->len > ARCH_EEP_SZ || e - b->data < b->len)
+				goto corrupted;
+			p = b->data + b->len;
+		} else if (p[0] == ARCH_REC_DELTA) {
+			tmp = arch_grow(a->deltas, a->ndeltas, sizeof(*d));
+			if (!tmp)
+				return -ENOMEM;
+			a->deltas = tmp;
+			d = &a->deltas[a->ndeltas++];
+			if (!arch_name_valid(name, p[1]))
+				goto corrupted;
+			snprintf(d->name, sizeof(d->name), "%.*s", p[1], name);
+			d->len = get_le16(p + 2);
+			d->base = get_le16(p + 8);
+			d->nruns = get_le16(p + 10);
+			d->runs = name + p[1];
+			if (d->len > ARCH_EEP_SZ || d->base >= a->nbases)
+				goto corrupted;
+			for (p = d->runs, i = 0; i < d->nruns; ++i) {
+				if (e - p < 4)
+					goto corrupted;
+				cnt = get_le16(p + 2);
+				if ((get_le16(p) + cnt) * 2 > ((d->len + 1) & ~1) ||
+				    e - p < 4 + cnt * 2)
+					goto corrupted;
+				p += 4 + cnt * 2;
+			}
+		} else {
+			goto corrupted;
+		}
+	}
+
+	return 0;
+
+corrupted:
+	fprintf(stderr, "archive: '%s' is corrupted at 0x%zx\n", fname,
+		p - a->map);
+
+	return -EINVAL;
+}
+
+static void arch_close(struct arch *a)
+{
+	unsigned i;
+
+	for (i = 0; i < a->nbases; ++i)
+		free(a->bases[i].buf);
+	if (a->map)
+		munmap(a->map, a->mapsz);
+	free(a->bases);
+	free(a->deltas);
+}
+
+/* Latest registered baseline of the chip and EEPROM version */
+static int arch_base_find(const struct arch *a, uint16_t chipid,
+			  uint16_t version)
+{
+	int i;
+
+	for (i = a->nbases - 1; i >= 0; --i)
+		if (a->bases[i].chipid == chipid &&
+		    a->bases[i].version == version)
+			return i;
+
+	return -1;
+}
+
+/**
+ * Reconstruct an image into the EEPROM buffer: a bulk baseline copy
+ * followed by copying of the contiguous runs, both are plain memcpy() and
+ * vectorized by the C library.
+ */
+static void arch_apply(const struct arch *a, const struct arch_delta *d,
+		       uint8_t *buf)
+{
+	const struct arch_base *b = &a->bases[d->base];
+	const uint8_t *p = d->runs;
+	unsigned i, cnt, n = b->len < d->len ? b->len : d->len;
+
+	memcpy(buf, b->data, n);
+	memset(buf + n, 0xff, d->len - n);
+
+	for (i = 0; i < d->nruns; ++i, p += 4 + cnt * 2) {
+		cnt = get_le16(p + 2);
+		memcpy(buf + get_le16(p) * 2, p + 4, cnt * 2);
+	}
+}
+
+static int arch_write(FILE *fp, int type, const char *name, unsigned len,
+		      uint16_t chipid, uint16_t version, unsigned base,
+		      unsigned nruns, const uint8_t *payload, size_t plen)
+{
+	uint8_t hdr[ARCH_HDR_LEN], *p = hdr;
+	size_t nlen = strlen(name);
+
+	if (nlen > 0xff)
+		nlen = 0xff;
+
+	*p++ = type;
+	*p++ = nlen;
+	p = put_le16(p, len);
+	p = put_le16(p, chipid);
+	p = put_le16(p, version);
+	p = put_le16(p, base);
+	p = put_le16(p, nruns);
+
+	if (fwrite(hdr, sizeof(hdr), 1, fp) != 1 ||
+	    fwrite(name, 1, nlen, fp) != nlen ||
+	    fwrite(payload, 1, plen, fp) != plen)
+		return -EIO;
+
+	return 0;
+}
+
+/* Baseline byte as arch_apply() restores it */
+static inline uint8_t arch_base_byte(const struct arch_base *b, unsigned i)
+{
+	return i < b->len ? b->data[i] : 0xff;
+}
+
+/* Whether the image word is equal to the baseline one */
+static inline int arch_word_same(const struct arch_base *b, const uint8_t *img,
+				 unsigned w)
+{
+	return img[w * 2] == arch_base_byte(b, w * 2) &&
+	       img[w * 2 + 1] == arch_base_byte(b, w * 2 + 1);
+}
+
+/* Encode runs of changed words, returns the encoded runs size */
+static size_t arch_encode(const struct arch_base *b, const uint8_t *img,
+			  unsigned len, uint8_t *out, unsigned *nruns)
+{
+	unsigned nw = (len + 1) / 2, w = 0, e, gap;
+	uint8_t *p = out;
+
+	*nruns = 0;
+	while (1) {
+		for (; w < nw && arch_word_same(b, img, w); ++w);
+		if (w == nw)
+			break;
+
+		/* Extend the run while unchanged gaps are small */
+		for (e = w + 1, gap = 0; e + gap < nw && gap <= ARCH_RUN_GAP_MAX;) {
+			if (arch_word_same(b, img, e + gap)) {
+				gap++;
+			} else {
+				e += gap + 1;
+				gap = 0;
+			}
+		}
+
+		p = put_le16(p, w);
+		p = put_le16(p, e - w);
+		memcpy(p, img + w * 2, (e - w) * 2);
+		p += (e - w) * 2;
+		(*nruns)++;
+		w = e;
+	}
+
+	return p - out;
+}
+
+/* Encode the image delta and check that it restores the image exactly */
+static int arch_delta_make(const struct arch *a, unsigned base,
+			   const uint8_t *img, unsigned len, uint8_t *runs,
+			   struct arch_delta *d, size_t *sz)
+{
+	uint8_t chk[ARCH_EEP_SZ];
+
+	*sz = arch_encode(&a->bases[base], img, len, runs, &d->nruns);
+	d->base = base;
+	d->len = len;
+	d->runs = runs;
+	arch_apply(a, d, chk);
+
+	return memcmp(chk, img, len) != 0 ? -EINVAL : 0;
+}
+
+static const char *arch_name(const char *path)
+{
+	const char *p = strrchr(path, '/');
+
+	return p ? p + 1 : path;
+}
+
+static unsigned arch_hash(const char *str)
+{
+	unsigned h = 2166136261U;	/* FNV-1a */
+
+	for (; *str; ++str)
+		h = (h ^ (uint8_t)*str) * 16777619U;
+
+	return h;
+}
+
+static int arch_names_init(struct arch_names *ns, unsigned n)
+{
+	unsigned sz;
+
+	for (sz = 64; sz < n * 2; sz *= 2);
+	ns->slots = calloc(sz, sizeof(ns->slots[0]));
+	ns->mask = sz - 1;
+
+	return ns->slots ? 0 : -ENOMEM;
+}
+
+static void arch_names_free(struct arch_names *ns)
+{
+	unsigned i;
+
+	for (i = 0; ns->slots && i <= ns->mask; ++i)
+		free(ns->slots[i]);
+	free(ns->slots);
+}
+
+/* Returns 1 if the name was added and 0 if it is already in the set */
+static int arch_names_add(struct arch_names *ns, const char *name)
+{
+	unsigned i;
+
+	for (i = arch_hash(name) & ns->mask; ns->slots[i];
+	     i = (i + 1) & ns->mask)
+		if (strcmp(ns->slots[i], name) == 0)
+			return 0;
+
+	ns->slots[i] = strdup(name);
+
+	return ns->slots[i] ? 1 : -ENOMEM;
+}
+
+/* Name of a new image: the file base name, suffixed on collision */
+static int arch_unique_name(struct arch_names *ns, const char *path,
+			    char *buf, size_t sz)
+{
+	const char *name = arch_name(path);
+	char sfx[0x10] = "";
+	unsigned i = 0;
+	int res;
+
+	do {
+		if (i)
+			snprintf(sfx, sizeof(sfx), "~%u", i);
+		snprintf(buf, sz, "%.*s%s", (int)(0xff - strlen(sfx)), name,
+			 sfx);
+		res = arch_names_add(ns, buf);
+		i++;
+	} while (res == 0);
+
+	return res < 0 ? res : 0;
+}
+
+/* Register a new baseline and store it to the archive */
+static int arch_base_add(struct arch *a, FILE *fp, struct main_ctx *mc,
+			 const char *fname)
+{
+	struct arch_base *b;
+	void *tmp;
+
+	tmp = arch_grow(a->bases, a->nbases, sizeof(*b));
+	if (!tmp)
+		return -ENOMEM;
+	a->bases = tmp;
+	b = &a->bases[a->nbases];
+	b->buf = malloc(mc->eep_len);
+	if (!b->buf)
+		return -ENOMEM;
+	memcpy(b->buf, mc->eep_buf, mc->eep_len);
+	b->data = b->buf;
+	b->len = mc->eep_len;
+	b->chipid = eep_read_word(mc, E_CHIPID);
+	b->version = eep_read_word(mc, E_VERSION);
+	a->nbases++;
+
+	return arch_write(fp, ARCH_REC_BASE, arch_name(fname), b->len,
+			  b->chipid, b->version, 0, 0, b->data, b->len);
+}
+
+int act_archive(struct main_ctx *mc, int argc, char *argv[])
+{
+	const char *fname = argv[0];
+	unsigned nruns, nimages = 0, nbases, i;
+	size_t raw = 0, sz;
+	long start;
+	struct arch_names ns = {0};
+	struct corpus c = {0};
+	struct arch_delta d;
+	uint8_t *runs = NULL;
+	char name[0x100];
+	struct arch a;
+	FILE *fp = NULL;
+	int base, res;
+
+	res = arch_open(&a, fname);
+	if (res)
+		goto exit;
+	nbases = a.nbases;
+
+	fp = fopen(fname, "ab");
+	if (!fp) {
+		fprintf(stderr, "archive: unable to open '%s' for writing: %s\n",
+			fname, strerror(errno));
+		res = -errno;
+		goto exit;
+	}
+	start = ftell(fp);
+	if (start == 0 &&
+	    fwrite(ARCH_MAGIC, ARCH_MAGIC_LEN, 1, fp) != 1) {
+		res = -EIO;
+		goto exit;
+	}
+
+	/* Explicitly specified baselines */
+	for (argc--, argv++; argc && strncmp(argv[0], "base=", 5) == 0;
+	     argc--, argv++) {
+		res = corpus_load_raw(mc, argv[0] + 5);
+		if (!res)
+			res = arch_base_add(&a, fp, mc, argv[0] + 5);
+		if (res)
+			goto exit;
+	}
+
+	if (argc) {
+		res = corpus_init(&c, argc, argv);
+		if (res)
+			goto exit;
+	}
+
+	res = arch_names_init(&ns, a.ndeltas + c.nfiles);
+	for (i = 0; !res && i < a.ndeltas; ++i)
+		res = arch_names_add(&ns, a.deltas[i].name) < 0 ? -ENOMEM : 0;
+	if (res)
+		goto exit;
+
+	/* Worst case: each changed word takes a run */
+	runs = malloc(ARCH_EEP_SZ / 2 * 6);
+	if (!runs) {
+		res = -ENOMEM;
+		goto exit;
+	}
+
+	for (i = 0; i < c.nfiles; ++i) {
+		res = corpus_load_raw(mc, c.files[i]);
+		if (res)
+			continue;	/* Skip unreadable images */
+
+		/* The first image of a new chip or version becomes a baseline */
+		base = arch_base_find(&a, eep_read_word(mc, E_CHIPID),
+				      eep_read_word(mc, E_VERSION));
+		if (base >= 0 &&
+		    arch_delta_make(&a, base, mc->eep_buf, mc->eep_len, runs,
+				    &d, &sz)) {
+			/* Should never happen, but the image is not lost */
+			fprintf(stderr, "archive: '%s' round trip check failed, storing it as a baseline\n",
+				c.files[i]);
+			base = -1;
+		}
+		if (base < 0) {
+			res = arch_base_add(&a, fp, mc, c.files[i]);
+			if (res)
+				goto exit;
+			base = a.nbases - 1;
+			if (arch_delta_make(&a, base, mc->eep_buf, mc->eep_len,
+					    runs, &d, &sz)) {
+				fprintf(stderr, "archive: '%s' round trip check failed, skipped\n",
+					c.files[i]);
+				continue;
+			}
+		}
+		nruns = d.nruns;
+
+		res = arch_unique_name(&ns, c.files[i], name, sizeof(name));
+		if (res)
+			goto exit;
+		res = arch_write(fp, ARCH_REC_DELTA, name, mc->eep_len,
+				 eep_read_word(mc, E_CHIPID),
+				 eep_read_word(mc, E_VERSION), base, nruns, runs,
+				 sz);
+		if (res)
+			goto exit;
+
+		raw += mc->eep_len;
+		nimages++;
+	}
+
+	printf("Archived %u images (%zu bytes) as %ld bytes, %u new baselines, %u skipped\n",
+	       nimages, raw, ftell(fp) - start, a.nbases - nbases,
+	       c.nfiles - nimages);
+
+	res = 0;
+
+exit:
+	if (fp && fclose(fp) && !res)
+		res = -EIO;
+	if (res == -EIO)
+		fprintf(stderr, "archive: unable to write '%s'\n", fname);
+	free(runs);
+	arch_names_free(&ns);
+	corpus_free(&c);
+	arch_close(&a);
+
+	return res;
+}
+
+static int arch_extract_one(const struct arch *a, const struct arch_delta *d,
+			    struct main_ctx *mc, const char *dir)
+{
+	char path[0x200];
+	FILE *fp;
+	size_t res;
+	int err;
+
+	arch_apply(a, d, mc->eep_buf);
+	mc->eep_len = d->len;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, d->name);
+	fp = fopen(path, "wb");
+	if (!fp) {
+		err = errno;
+		fprintf(stderr, "archive: unable to create '%s': %s\n", path,
+			strerror(err));
+		return -err;
+	}
+	res = fwrite(mc->eep_buf, 1, mc->eep_len, fp);
+	if (fclose(fp) || res != mc->eep_len) {
+		fprintf(stderr, "archive: unable to write '%s'\n", path);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/* List archived images or reconstruct them to a directory */
+int act_extract(struct main_ctx *mc, int argc, char *argv[])
+{
+	const char *dir = argc >= 2 ? argv[1] : NULL;
+	const char *pattern = argc >= 3 ? argv[2] : "*";
+	const struct arch_delta *d;
+	const struct chip_desc *chip;
+	unsigned i, n = 0;
+	struct arch a;
+	int res;
+
+	res = arch_open(&a, argv[0]);
+	if (res)
+		goto exit;
+
+	if (!dir)
+		printf("%-32s %-8s %-7s %5s %5s\n", "Image", "Chip", "Version",
+		       "Size", "Runs");
+
+	for (i = 0; i < a.ndeltas; ++i) {
+		d = &a.deltas[i];
+		if (fnmatch(pattern, d->name, 0) != 0)
+			continue;
+		n++;
+		if (dir) {
+			res = arch_extract_one(&a, d, mc, dir);
+			if (res)
+				goto exit;
+			continue;
+		}
+		chip = chip_find(a.bases[d->base].chipid);
+		printf("%-32s %-8s %3u.%-3u %5u %5u\n", d->name,
+		       chip ? chip->name : "unknown",
+		       a.bases[d->base].version >> 8,
+		       a.bases[d->base].version & 0xff, d->len, d->nruns);
+	}
+
+	if (dir)
+		printf("Extracted %u images to %s\n", n, dir);
+
+exit:
+	arch_close(&a);
+
+	return res;
+}
@@ -0,0 +1,356 @@
+/**
+ * Batch comparison against a golden EEPROM image
+ *
+ * Copyright (c) 2016-2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fnmatch.h>
+
+#include "mtkeepmgr.h"
+#include "field.h"
+#include "corpus.h"
+
+#define CMP_TOP_DEF		10
+#define CMP_RULES_MAX		0x100
+
+/* Tolerance rule, the first matching rule wins */
+struct cmp_rule {
+	char pattern[0x40];
+	double tol;			/* In the field output units */
+	int skip;			/* Do not compare matched fields */
+};
+
+struct cmp_field {
+	const struct eep_field *f;
+	int golden;			/* Golden image value */
+	double tol;
+	unsigned nfail;			/* Number of failed units */
+};
+
+struct cmp_unit {
+	unsigned nfail;			/* Number of failed fields */
+	double excess;			/* Max deviation beyond tolerance */
+	const struct eep_field *worst;	/* Field of the max excess */
+};
+
+struct cmp_ctx {
+	const struct chip_desc *chip;
+	struct cmp_field *fields;
+	unsigned nfields;
+	double *worst;			/* Per thread, per field max excess */
+	struct cmp_unit *units;
+};
+
+static double cmp_scale(const struct eep_field *f)
+{
+	return f->flags & EEP_FF_HALF ? 0.5 : 1.0;
+}
+
+static int cmp_rule_parse(struct cmp_rule *r, const char *pattern,
+			  size_t plen, const char *tol)
+{
+	char *endp;
+
+	if (!plen || plen >= sizeof(r->pattern))
+		return -EINVAL;
+	memcpy(r->pattern, pattern, plen);
+	r->pattern[plen] = '\0';
+
+	r->skip = strcmp(tol, "-") == 0;
+	if (r->skip)
+		return 0;
+
+	if (strncmp(tol, "±", strlen("±")) == 0)
+		tol += strlen("±");
+	else if (strncmp(tol, "+-", 2) == 0)
+		tol += 2;
+	r->tol = strtod(tol, &endp);
+	if (endp == tol || r->tol < 0)
+		return -EINVAL;
+
+	return 0;
+}
+
+/**
+ * Tolerance rules file line format: <pattern> <tolerance>, where pattern
+ * is a shell-style field name pattern (e.g. txpwr.5g.*) and tolerance is a
+ * maximum absolute deviation in the field units (e.g. dB) or '-' to skip
+ * the matched fields.
+ */
+static int cmp_rules_load(const char *fname, struct cmp_rule *rules,
+			  unsigned *nrules)
+{
+	char line[0x100], pattern[0x40], tol[0x20];
+	unsigned lineno = 0;
+	FILE *fp;
+	int err;
+
+	fp = fopen(fname, "r");
+	if (!fp) {
+		err = errno;
+		fprintf(stderr, "compare: unable to open rules file '%s': %s\n",
+			fname, strerror(err));
+		return -err;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if (line[strspn(line, " \t\r\n")] == '\0' ||
+		    line[strspn(line, " \t")] == '#')
+			continue;
+		if (*nrules == CMP_RULES_MAX ||
+		    sscanf(line, "%63s %31s", pattern, tol) != 2 ||
+		    cmp_rule_parse(&rules[*nrules], pattern, strlen(pattern),
+				   tol)) {
+			fprintf(stderr, "compare: %s:%u: invalid tolerance rule\n",
+				fname, lineno);
+			fclose(fp);
+			return -EINVAL;
+		}
+		(*nrules)++;
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+static int cmp_image(struct main_ctx *mc, unsigned idx, unsigned tidx,
+		     void *priv)
+{
+	struct cmp_ctx *cc = priv;
+	struct cmp_unit *u = &cc->units[idx];
+	double *worst = &cc->worst[tidx * cc->nfields];
+	struct cmp_field *cf;
+	double dev;
+	unsigned i;
+
+	if (eep_read_word(mc, E_CHIPID) != cc->chip->chipid)
+		return -ENODEV;
+
+	for (i = 0; i < cc->nfields; ++i) {
+		cf = &cc->fields[i];
+		dev = abs(field_value(mc, cf->f) - cf->golden) * cmp_scale(cf->f);
+		if (dev <= cf->tol)
+			continue;
+		__atomic_fetch_add(&cf->nfail, 1, __ATOMIC_RELAXED);
+		u->nfail++;
+		if (dev - cf->tol > u->excess || !u->worst) {
+			u->excess = dev - cf->tol;
+			u->worst = cf->f;
+		}
+		if (dev - cf->tol > worst[i])
+			worst[i] = dev - cf->tol;
+	}
+
+	return 0;
+}
+
+static const struct cmp_ctx *cmp_sort_ctx;
+
+/* Order: more failed fields first, then bigger excess */
+static int cmp_unit_cmp(const void *a, const void *b)
+{
+	const struct cmp_unit *ua = &cmp_sort_ctx->units[*(const unsigned *)a];
+	const struct cmp_unit *ub = &cmp_sort_ctx->units[*(const unsigned *)b];
+
+	if (ua->nfail != ub->nfail)
+		return ua->nfail < ub->nfail ? 1 : -1;
+	if (ua->excess != ub->excess)
+		return ua->excess < ub->excess ? 1 : -1;
+
+	return 0;
+}
+
+static void cmp_report(const struct cmp_ctx *cc, const struct corpus *c,
+		       unsigned nthreads, unsigned top)
+{
+	unsigned i, t, n, nfailed = 0, *order;
+	const struct cmp_field *cf;
+	char buf[0x20];
+	double worst;
+
+	printf("\n[Fields out of tolerance]\n");
+	printf("  %-24s %10s %9s %7s %9s\n", "Field", "Golden", "Tolerance",
+	       "Failed", "MaxExcess");
+	for (i = 0, n = 0; i < cc->nfields; ++i) {
+		cf = &cc->fields[i];
+		if (!cf->nfail)
+			continue;
+		for (t = 0, worst = 0; t < nthreads; ++t)
+			if (cc->worst[t * cc->nfields + i] > worst)
+				worst = cc->worst[t * cc->nfields + i];
+		snprintf(buf, sizeof(buf), "%g", cf->golden * cmp_scale(cf->f));
+		printf("  %-24s %10s %9g %7u %9g\n", cf->f->name, buf, cf->tol,
+		       cf->nfail, worst);
+		n++;
+	}
+	if (!n)
+		printf("  None\n");
+
+	order = malloc(c->nfiles * sizeof(*order));
+	if (!order)
+		return;
+	for (i = 0, n = 0; i < c->nfiles; ++i) {
+		if (!cc->units[i].nfail)
+			continue;
+		order[n++] = i;
+		nfailed++;
+	}
+	cmp_sort_ctx = cc;
+	qsort(order, n, sizeof(*order), cmp_unit_cmp);
+
+	printf("\n[Worst units]\n");
+	printf("  %-40s %6s %-24s %9s\n", "Unit", "Failed", "WorstField",
+	       "MaxExcess");
+	for (i = 0; i < n && i < top; ++i)
+		printf("  %-40s %6u %-24s %9g\n", c->files[order[i]],
+		       cc->units[order[i]].nfail,
+		       cc->units[order[i]].worst->name,
+		       cc->units[order[i]].excess);
+	if (!n)
+		printf("  None\n");
+
+	free(order);
+}
+
+/**
+ * Compare each image of the corpus against the golden one using per field
+ * tolerance rules and report the fields and units statistics.
+ *
+ * Arguments: <golden> [rules=<file>] [tol:<pattern>=<tol>]... [top=<n>]
+ *            [threads=<n>] <image|dir>...
+ */
+int act_compare(struct main_ctx *mc, int argc, char *argv[])
+{
+	static struct cmp_rule rules[CMP_RULES_MAX];
+	unsigned nrules = 0, top = CMP_TOP_DEF, nthreads, i, r, n;
+	struct cmp_ctx cc = {};
+	const struct eep_field *f;
+	const char *golden, *eq;
+	struct corpus c;
+	long nthr = 0;
+	int res;
+
+	if (argc < 2) {
+		fprintf(stderr, "compare: golden image and EEPROM images are required\n");
+		return -EINVAL;
+	}
+
+	golden = argv[0];
+	res = corpus_load(mc, golden);
+	if (res)
+		return res;
+	cc.chip = chip_find(eep_read_word(mc, E_CHIPID));
+	if (!cc.chip) {
+		fprintf(stderr, "compare: golden image is for unknown chip (chipid:0x%04x)\n",
+			eep_read_word(mc, E_CHIPID));
+		return -EINVAL;
+	}
+
+	for (--argc, ++argv; argc; --argc, ++argv) {
+		if (strncmp(argv[0], "rules=", 6) == 0) {
+			res = cmp_rules_load(argv[0] + 6, rules, &nrules);
+			if (res)
+				return res;
+		} else if (strncmp(argv[0], "tol:", 4) == 0) {
+			eq = strchr(argv[0] + 4, '=');
+			if (!eq || nrules == CMP_RULES_MAX ||
+			    cmp_rule_parse(&rules[nrules], argv[0] + 4,
+					   eq - argv[0] - 4, eq + 1)) {
+				fprintf(stderr, "compare: invalid tolerance rule -- %s\n",
+					argv[0]);
+				return -EINVAL;
+			}
+			nrules++;
+		} else if (strncmp(argv[0], "top=", 4) == 0) {
+			top = strtoul(argv[0] + 4, NULL, 0);
+		} else if (strncmp(argv[0], "threads=", 8) == 0) {
+			nthr = strtol(argv[0] + 8, NULL, 0);
+		} else {
+			break;
+		}
+	}
+
+	/* Decode golden image once into the field vector */
+	for_each_field(cc.chip, f)
+		cc.nfields++;
+	for_each_field(cc.chip, f)
+		if (field_is_calib(f))
+			break;
+	if (!f || !f->name) {
+		/* Identification fields only, units would always match */
+		fprintf(stderr, "compare: %s chip has no calibration fields\n",
+			cc.chip->name);
+		return -EINVAL;
+	}
+	cc.fields = calloc(cc.nfields, sizeof(*cc.fields));
+	if (!cc.fields)
+		return -ENOMEM;
+	n = 0;
+	for_each_field(cc.chip, f) {
+		if (f->flags & EEP_FF_MACADDR || f->off == E_CHIPID)
+			continue;
+		for (r = 0; r < nrules; ++r)
+			if (fnmatch(rules[r].pattern, f->name, 0) == 0)
+				break;
+		if (r < nrules && rules[r].skip)
+			continue;
+		cc.fields[n].f = f;
+		cc.fields[n].golden = field_value(mc, f);
+		cc.fields[n].tol = r < nrules ? rules[r].tol : 0;
+		n++;
+	}
+	cc.nfields = n;
+
+	res = corpus_init(&c, argc, argv);
+	if (res)
+		goto exit_fields;
+
+	nthreads = corpus_nthreads(&c, nthr);
+	cc.worst = calloc(nthreads * cc.nfields, sizeof(*cc.worst));
+	cc.units = calloc(c.nfiles, sizeof(*cc.units));
+	if (!cc.worst || !cc.units) {
+		res = -ENOMEM;
+		goto exit;
+	}
+
+	res = corpus_run(&c, nthreads, cmp_image, &cc);
+	if (res < 0)
+		goto exit;
+
+	for (i = 0, n = 0; i < c.nfiles; ++i)
+		n += !!cc.units[i].nfail;
+	printf("Golden: %s (%s), %u fields; units: %u compared, %u failed, %d skipped\n",
+	       golden, cc.chip->name, cc.nfields,
+	       c.nfiles - res, n, res);
+	cmp_report(&cc, &c, nthreads, top);
+
+	res = n || res ? -1 : 0;
+
+exit:
+	free(cc.units);
+	free(cc.worst);
+	corpus_free(&c);
+
+exit_fields:
+	free(cc.fields);
+
+	return res;
+}
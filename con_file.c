@@ -24,11 +24,14 @@
 #include <sys/stat.h>
 
 #include "mtkeepmgr.h"
+#include "trace.h"
 
 struct file_priv {
 	int fd;
 };
 
+TRACE_SEMAPHORE(file_read);
+
 static int file_init(struct main_ctx *mc, const char *arg_str)
 {
 	struct file_priv *fpd = mc->con_priv;
@@ -59,12 +62,15 @@ static int file_init(struct main_ctx *mc, const char *arg_str)
 	}
 
 	ret = read(fpd->fd, mc->eep_buf, mc->eep_len);
+	TRACE2(file_read, mc->eep_len, ret);
 	if (ret != mc->eep_len) {
 		fprintf(stderr, "filecon: unable to read whole input file: %s\n",
 			strerror(errno));
 		goto err;
 	}
 
+	snprintf(mc->dev_path, sizeof(mc->dev_path), "%s", arg_str);
+
 	return 0;
 
 err:
@@ -77,6 +83,21 @@ err:
 	return -err;
 }
 
+static int file_fetch(struct main_ctx *mc, unsigned off, unsigned len)
+{
+	struct file_priv *fpd = mc->con_priv;
+	ssize_t res;
+
+	res = pread(fpd->fd, &mc->eep_buf[off], len, off);
+	if (res != len) {
+		fprintf(stderr, "filecon: unable to read dump file at 0x%04x: %s\n",
+			off, res < 0 ? strerror(errno) : "short read");
+		return -EIO;
+	}
+
+	return 0;
+}
+
 static void file_clean(struct main_ctx *mc)
 {
 	struct file_priv *fpd = mc->con_priv;
@@ -90,4 +111,5 @@ const struct connector_desc con_file = {
 	.priv_sz = sizeof(struct file_priv),
 	.init = file_init,
 	.clean = file_clean,
+	.fetch = file_fetch,
 };
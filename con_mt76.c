@@ -0,0 +1,113 @@
+/**
+ * mt76 driver debugfs connector
+ *
+ * Copyright (c) 2016-2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mtkeepmgr.h"
+
+#define MT76_DEBUGFS_ROOT	"/sys/kernel/debug/ieee80211"
+
+struct mt76_priv {
+	int fd;
+};
+
+/**
+ * Argument is a wiphy name (e.g. phy0) or just a wiphy index. The mt76
+ * driver exposes a copy of the EEPROM data, which it uses, as a debugfs
+ * blob, so the data could be read without the driver unbinding.
+ */
+static int mt76_init(struct main_ctx *mc, const char *arg_str)
+{
+	struct mt76_priv *mpd = mc->con_priv;
+	char path[0x100], *endp;
+	unsigned long idx;
+	ssize_t res;
+	int err;
+
+	idx = strtoul(arg_str, &endp, 10);
+	if (*arg_str != '\0' && *endp == '\0')
+		snprintf(path, sizeof(path), MT76_DEBUGFS_ROOT "/phy%lu/mt76/eeprom",
+			 idx);
+	else
+		snprintf(path, sizeof(path), MT76_DEBUGFS_ROOT "/%s/mt76/eeprom",
+			 arg_str);
+
+	mpd->fd = open(path, O_RDONLY);
+	if (mpd->fd == -1) {
+		err = errno;
+		fprintf(stderr, "mt76con: unable to open '%s': %s\n", path,
+			strerror(err));
+		if (err == ENOENT && access(MT76_DEBUGFS_ROOT, F_OK) != 0)
+			fprintf(stderr, "mt76con: is debugfs mounted?\n");
+		else if (err == ENOENT)
+			fprintf(stderr, "mt76con: is '%s' a mt76 driver wiphy?\n",
+				arg_str);
+		return -err;
+	}
+
+	/* Blob could be smaller than the buffer, so read it till the end */
+	mc->eep_len = 0;
+	do {
+		res = read(mpd->fd, mc->eep_buf + mc->eep_len,
+			   sizeof(mc->eep_buf) - mc->eep_len);
+		if (res > 0)
+			mc->eep_len += res;
+	} while (res > 0 && mc->eep_len < sizeof(mc->eep_buf));
+	if (res < 0) {
+		err = errno;
+		fprintf(stderr, "mt76con: unable to read '%s': %s\n", path,
+			strerror(err));
+		goto err;
+	}
+	mc->eep_len &= ~1;
+	if (!mc->eep_len) {
+		fprintf(stderr, "mt76con: driver exposes no EEPROM data\n");
+		err = ENODATA;
+		goto err;
+	}
+
+	snprintf(mc->dev_path, sizeof(mc->dev_path), "%s", path);
+
+	return 0;
+
+err:
+	close(mpd->fd);
+	mpd->fd = -1;
+
+	return -err;
+}
+
+static void mt76_clean(struct main_ctx *mc)
+{
+	struct mt76_priv *mpd = mc->con_priv;
+
+	close(mpd->fd);
+	mpd->fd = -1;
+}
+
+const struct connector_desc con_mt76 = {
+	.name = "mt76",
+	.priv_sz = sizeof(struct mt76_priv),
+	.init = mt76_init,
+	.clean = mt76_clean,
+};
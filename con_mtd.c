@@ -0,0 +1,218 @@
+/**
+ * MTD/block device connector
+ *
+ * Copyright (c) 2016-2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <mtd/mtd-user.h>
+
+#include "mtkeepmgr.h"
+
+struct mtd_priv {
+	int fd;
+	off_t off;		/* EEPROM data window offset */
+};
+
+/**
+ * Resolve MTD partition name (e.g. "factory") to the device path using the
+ * /proc/mtd table.
+ */
+static int mtd_find_by_name(const char *name, char *path, size_t pathsz)
+{
+	char line[0x100], pname[0x40];
+	unsigned idx;
+	FILE *fp;
+	int res = -ENOENT;
+
+	fp = fopen("/proc/mtd", "r");
+	if (!fp)
+		return -errno;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "mtd%u: %*x %*x \"%63[^\"]\"", &idx, pname) != 2)
+			continue;
+		if (strcmp(pname, name) != 0)
+			continue;
+		snprintf(path, pathsz, "/dev/mtd%u", idx);
+		res = 0;
+		break;
+	}
+
+	fclose(fp);
+
+	return res;
+}
+
+/* Determine the data source size, whatever it is */
+static int mtd_get_size(int fd, uint64_t *size)
+{
+	struct mtd_info_user mtdinfo;
+	struct stat st;
+
+	if (fstat(fd, &st))
+		return -errno;
+
+	if (S_ISREG(st.st_mode)) {
+		*size = st.st_size;
+	} else if (S_ISBLK(st.st_mode)) {
+		if (ioctl(fd, BLKGETSIZE64, size))
+			return -errno;
+	} else if (S_ISCHR(st.st_mode)) {
+		if (ioctl(fd, MEMGETINFO, &mtdinfo))
+			return -errno;
+		*size = mtdinfo.size;
+	} else {
+		return -ENODEV;
+	}
+
+	return 0;
+}
+
+/**
+ * Argument format: <dev>[:<off>[:<len>]], where <dev> is a device (or a
+ * file) path, MTD device name (e.g. mtd2) or MTD partition name
+ * (e.g. factory).
+ */
+static int mtd_init(struct main_ctx *mc, const char *arg_str)
+{
+	struct mtd_priv *mpd = mc->con_priv;
+	char path[0x100], *p, *endp;
+	unsigned long long off = 0, len = 0;
+	uint64_t size;
+	ssize_t res;
+	int err;
+
+	mpd->fd = -1;
+
+	snprintf(path, sizeof(path), "%s", arg_str);
+	p = strchr(path, ':');
+	if (p) {
+		*p++ = '\0';
+		off = strtoull(p, &endp, 0);
+		if (*endp == ':')
+			len = strtoull(endp + 1, &endp, 0);
+		if (*endp != '\0') {
+			fprintf(stderr, "mtdcon: invalid data window specification -- %s\n",
+				p);
+			return -EINVAL;
+		}
+	}
+
+	if (!strchr(path, '/')) {
+		if (strncmp(path, "mtd", 3) == 0 && path[3] >= '0' &&
+		    path[3] <= '9') {
+			memmove(path + 5, path, strlen(path) + 1);
+			memcpy(path, "/dev/", 5);
+		} else if (mtd_find_by_name(path, path, sizeof(path))) {
+			fprintf(stderr, "mtdcon: unable to find MTD partition '%s'\n",
+				path);
+			return -ENOENT;
+		}
+	}
+
+	mpd->fd = open(path, O_RDONLY);
+	if (mpd->fd == -1) {
+		fprintf(stderr, "mtdcon: unable to open '%s': %s\n", path,
+			strerror(errno));
+		goto err;
+	}
+
+	err = mtd_get_size(mpd->fd, &size);
+	if (err) {
+		fprintf(stderr, "mtdcon: unable to get '%s' size: %s\n", path,
+			strerror(-err));
+		errno = -err;
+		goto err;
+	}
+
+	if (off >= size) {
+		fprintf(stderr, "mtdcon: offset 0x%llx is beyond the '%s' end\n",
+			off, path);
+		errno = EINVAL;
+		goto err;
+	}
+	if (!len || len > size - off)
+		len = size - off;
+	if (len > sizeof(mc->eep_buf))
+		len = sizeof(mc->eep_buf);
+
+	mpd->off = off;
+	mc->eep_len = len & ~1;
+
+	res = pread(mpd->fd, mc->eep_buf, mc->eep_len, mpd->off);
+	if (res != mc->eep_len) {
+		fprintf(stderr, "mtdcon: unable to read data from '%s': %s\n",
+			path, res < 0 ? strerror(errno) : "short read");
+		if (res >= 0)
+			errno = EIO;
+		goto err;
+	}
+
+	snprintf(mc->dev_path, sizeof(mc->dev_path), "%s", path);
+
+	return 0;
+
+err:
+	err = errno;
+	if (mpd->fd != -1) {
+		close(mpd->fd);
+		mpd->fd = -1;
+	}
+
+	return -err;
+}
+
+static int mtd_fetch(struct main_ctx *mc, unsigned off, unsigned len)
+{
+	struct mtd_priv *mpd = mc->con_priv;
+	ssize_t res;
+
+	res = pread(mpd->fd, &mc->eep_buf[off], len, mpd->off + off);
+	if (res != len) {
+		fprintf(stderr, "mtdcon: unable to read data at 0x%04x: %s\n",
+			off, res < 0 ? strerror(errno) : "short read");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static void mtd_clean(struct main_ctx *mc)
+{
+	struct mtd_priv *mpd = mc->con_priv;
+
+	close(mpd->fd);
+	mpd->fd = -1;
+}
+
+const struct connector_desc con_mtd = {
+	.name = "MTD",
+	.priv_sz = sizeof(struct mtd_priv),
+	.init = mtd_init,
+	.clean = mtd_clean,
+	.fetch = mtd_fetch,
+};
@@ -17,10 +17,26 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#ifndef CONFIG_USBFS
 #include <libusb.h>
+#endif
+
+#include <sys/stat.h>
 
 #include "mtkeepmgr.h"
+#include "utils.h"
+#include "trace.h"
+#include "usbdb.h"
+#ifdef CONFIG_USBFS
+#include "usbfs.h"
+#endif
 
 #define USB_MATCH_FILTER_BUSNUM		BIT(0)	/* Bus number match */
 #define USB_MATCH_FILTER_DEVADDR	BIT(1)	/* Device address match */
@@ -30,8 +46,11 @@
 
 #define USB_MAX_PATHLEN			10
 
+#define USB_OPT_RESET			BIT(0)	/* Reset device on failures */
+
 struct usb_match_filter {
 	unsigned int mask;
+	unsigned int opts;	/* Connector options, see USB_OPT_xxx */
 	uint8_t busnum;		/* Bus number */
 	uint8_t devaddr;	/* Device address */
 	uint16_t vid;		/* Vendor ID */
@@ -40,30 +59,43 @@ struct usb_match_filter {
 	uint8_t path[USB_MAX_PATHLEN];	/* Sequence hub's ports */
 };
 
-static const struct dev_id {
-	uint16_t vid;
-	uint16_t pid;
-} devs[] = {
-	{0x148f, 0x7610},	/* Default ID of MT7610U */
-	{0x148f, 0x761a},	/* TP-Link T2U dongle */
-};
+#define USB_VENDOR_REQ_IN	(LIBUSB_ENDPOINT_IN |			\
+				 LIBUSB_REQUEST_TYPE_VENDOR |		\
+				 LIBUSB_RECIPIENT_DEVICE)
 
 /* MediaTek specific (vendor) USB device commands */
 enum usb_vend_cmd {
 	USB_VENDOR_EEP_READ = 0x09,		/* Calibration data read */
 };
 
+/* Transfer timeout estimation */
+struct usb_rtt {
+	unsigned nsamples;
+	unsigned srtt;			/* Smoothed latency, us per 0x100 bytes */
+	unsigned rttvar;		/* Latency mean deviation */
+};
+
 struct usb_priv {
 	struct libusb_context *ctx;
 	struct libusb_device_handle *udh;
+	const struct usbdb_entry *dbe;	/* Device DB entry, could be NULL */
+	unsigned int opts;		/* See USB_OPT_xxx */
+	struct usb_rtt rtt;
 };
 
+TRACE_SEMAPHORE(usb_xfer);
+TRACE_SEMAPHORE(usb_read_block);
+TRACE_SEMAPHORE(usb_eep_overlap);
+TRACE_SEMAPHORE(usb_enum_start);
+TRACE_SEMAPHORE(usb_enum_end);
+
 static int usb_parse_filter_arg(const char *str, struct usb_match_filter *f)
 {
 	char *__str, *s, *e, *p;
 	int ret = -1;
 
 	f->mask = 0;
+	f->opts = 0;
 	if (str[0] == '\0' || strcasecmp(str, "any") == 0)
 		return 0;
 
@@ -82,6 +114,13 @@ static int usb_parse_filter_arg(const char *str, struct usb_match_filter *f)
 		p = strchr(s, ',') ? : e;
 		*p = '\0';
 
+		if (strcasecmp(s, "reset") == 0) {
+			f->opts |= USB_OPT_RESET;
+			continue;
+		}
+		if (strcasecmp(s, "any") == 0)
+			continue;		/* Matches any device */
+
 		n = sscanf(s, "0x%x%n:0x%x%n", &v1, &l1, &v2, &l2);
 		if (n == 2 && l1 == 6 && l2 == 13) {
 			f->mask = USB_MATCH_FILTER_ID;
@@ -167,18 +206,183 @@ exit:
  * storage content). Reading perfomed using USB specific data obtaining
  * chip interface.
  */
+#define USB_XFER_TO_DEF		300	/* Default timeout per 0x100 bytes, ms */
+#define USB_XFER_TO_MIN		20	/* Min estimated timeout, ms */
+#define USB_XFER_SAMPLES_MIN	4	/* Latency samples to trust estimation */
+#define USB_RETRY_MAX		3	/* Retries per block before a reset */
+#define USB_BACKOFF_MAX		100	/* Max retry backoff, ms */
+
+static unsigned usb_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Select the transfer timeout from the observed latency (the same way as
+ * TCP estimates RTO): smoothed latency plus four mean deviations. Until
+ * there are enough samples, the conservative default is used.
+ */
+static unsigned usb_xfer_timeout(const struct usb_rtt *rtt, unsigned size)
+{
+	unsigned units = size / 0x100 ? : 1, to;
+
+	if (rtt->nsamples < USB_XFER_SAMPLES_MIN)
+		return USB_XFER_TO_DEF * units;
+
+	to = (rtt->srtt + 4 * rtt->rttvar) * units / 1000;
+	if (to < USB_XFER_TO_MIN)
+		to = USB_XFER_TO_MIN;
+	if (to > USB_XFER_TO_DEF * units)
+		to = USB_XFER_TO_DEF * units;
+
+	return to;
+}
+
+static void usb_rtt_update(struct usb_rtt *rtt, unsigned size, unsigned lat)
+{
+	unsigned units = size / 0x100 ? : 1, sample = lat / units;
+	int err = sample - rtt->srtt;
+
+	if (!rtt->nsamples++) {
+		rtt->srtt = sample;
+		rtt->rttvar = sample / 2;
+		return;
+	}
+
+	rtt->rttvar += ((err < 0 ? -err : err) - (int)rtt->rttvar) / 4;
+	rtt->srtt += err / 8;
+}
+
+static int usb_eep_xfer(struct main_ctx *mc, unsigned off, unsigned size,
+			uint8_t *buf, unsigned timeout)
+{
+	struct usb_priv *upd = mc->con_priv;
+	unsigned start = usb_time_us(), lat;
+	int res;
+
+	res = libusb_control_transfer(upd->udh, USB_VENDOR_REQ_IN,
+				      USB_VENDOR_EEP_READ, 0, off, buf,
+				      size, timeout);
+	lat = usb_time_us() - start;
+	TRACE4(usb_xfer, off, size, res, lat);
+	if (res > 0) {
+		usb_rtt_update(&upd->rtt, res, lat);
+		con_stats_xfer(mc, lat);
+	}
+
+	return res;
+}
+
+/**
+ * Read an EEPROM block. Failed transfers are retried with an exponential
+ * backoff and a doubled timeout, short reads are resumed from the first
+ * missing byte. If the device does not recover and the reset option is
+ * specified, then the device is reset once and the block is retried again.
+ * Returns the number of read bytes or a negative libusb error code.
+ */
 static int usb_eep_read_block(struct main_ctx *mc, unsigned off, unsigned size,
 			      uint8_t *buf)
 {
 	struct usb_priv *upd = mc->con_priv;
-	unsigned int timeout = 300 * (size / 0x100 ? : 1); /* ms */
-	const uint8_t bmRequestType = LIBUSB_ENDPOINT_IN |
-				      LIBUSB_REQUEST_TYPE_VENDOR |
-				      LIBUSB_RECIPIENT_DEVICE;
-
-	return libusb_control_transfer(upd->udh, bmRequestType,
-				       USB_VENDOR_EEP_READ, 0, off, buf,
-				       size, timeout);
+	struct con_stats *cs = &mc->cs;
+	unsigned done = 0, to, backoff = 10, attempt = 0, reset = 0;
+	unsigned start = TRACE_ACTIVE(usb_read_block) ? usb_time_us() : 0;
+	int res;
+
+	to = usb_xfer_timeout(&upd->rtt, size);
+	while (1) {
+		res = usb_eep_xfer(mc, off + done, size - done, buf + done, to);
+		if (res > 0)
+			done += res;
+		if (done == size) {
+			res = size;
+			break;
+		}
+
+		if (res == LIBUSB_ERROR_NO_DEVICE)
+			break;
+		if (res == LIBUSB_ERROR_TIMEOUT)
+			cs->ntimeouts++;
+		else if (res >= 0)
+			cs->nshort++;
+
+		if (++attempt > USB_RETRY_MAX) {
+			if (!(upd->opts & USB_OPT_RESET) || reset) {
+				res = done ? done : res;
+				break;
+			}
+			fprintf(stderr, "usbcon: device does not respond, resetting it\n");
+			res = libusb_reset_device(upd->udh);
+			cs->nresets++;
+			if (res < 0) {
+				fprintf(stderr, "usbcon: unable to reset device: %s\n",
+					libusb_strerror(res));
+				break;
+			}
+			reset = 1;
+			attempt = 0;
+			backoff = 10;
+			to = usb_xfer_timeout(&upd->rtt, size);
+			continue;
+		}
+
+		cs->nretries++;
+		usleep(backoff * 1000);
+		backoff = backoff * 2 > USB_BACKOFF_MAX ? USB_BACKOFF_MAX :
+							  backoff * 2;
+		if (res == LIBUSB_ERROR_TIMEOUT)
+			to = to * 2 > USB_XFER_TO_DEF * (size / 0x100 ? : 1) * 4 ?
+			     to : to * 2;
+	}
+
+	TRACE4(usb_read_block, off, size, res,
+	       start ? usb_time_us() - start : 0);
+
+	return res;
+}
+
+/* Lazy mode data fetching callback */
+static int usb_eep_fetch(struct main_ctx *mc, unsigned off, unsigned len)
+{
+	int res;
+
+	res = usb_eep_read_block(mc, off, len, &mc->eep_buf[off]);
+	if (res < 0) {
+		fprintf(stderr, "usbcon: unable to read EEPROM at 0x%04x: %s\n",
+			off, libusb_strerror(res));
+		return -EIO;
+	} else if (res != len) {
+		fprintf(stderr, "usbcon: read less then requested block (%d bytes instead of %u bytes)\n",
+			res, len);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/**
+ * EEPROM geometry of a known device is available from the devices database,
+ * so we do not need to read the whole EEPROM in advance to detect its size.
+ * Configure the lazy mode instead and fetch blocks on demand.
+ */
+static void usb_eep_lazy_init(struct main_ctx *mc)
+{
+	struct usb_priv *upd = mc->con_priv;
+	unsigned len = upd->dbe->eep_sz;
+
+	if (len > sizeof(mc->eep_buf)) {
+		fprintf(stderr, "usbcon: EEPROM is bigger then internal buffer, analysis will be limited by a %zu bytes\n",
+			sizeof(mc->eep_buf));
+		len = sizeof(mc->eep_buf);
+	}
+
+	mc->eep_len = len;
+	mc->eep_blk_sz = 0x20;
+	mc->eep_xfer_max = upd->dbe->xfer_sz ? : mc->eep_blk_sz;
 }
 
 static int usb_eep2buf(struct main_ctx *mc)
@@ -208,6 +412,7 @@ static int usb_eep2buf(struct main_ctx *mc)
 			res = memcmp(&mc->eep_buf[0], &mc->eep_buf[off],
 				     READ_BLOCK_SZ);
 			if (res == 0) {
+				TRACE1(usb_eep_overlap, off);
 				printf("usbcon: EEPROM overlap detected at 0x%04x\n",
 				       off);
 				break;
@@ -226,12 +431,370 @@ static int usb_eep2buf(struct main_ctx *mc)
 #undef READ_BLOCK_SZ
 }
 
+/* Minimal device identity, which is required to apply a match filter */
+struct usb_dev_info {
+	uint8_t busnum;
+	uint8_t devaddr;
+	uint16_t vid;
+	uint16_t pid;
+	int plen;			/* Path length, -1 if unknown */
+	uint8_t path[USB_MAX_PATHLEN];
+	uint8_t iserial;		/* Serial number string index */
+};
+
+/* Format device location in the sysfs manner, e.g. 3-1.2 */
+static void usb_dev_path(const struct usb_dev_info *di, char *buf,
+			 size_t bufsz)
+{
+	char *p = buf, *e = buf + bufsz;
+	int i;
+
+	if (di->plen <= 0) {
+		snprintf(buf, bufsz, "%u:%u", di->busnum, di->devaddr);
+		return;
+	}
+
+	p += snprintf(p, e - p, "%u", di->busnum);
+	for (i = 0; i < di->plen && p < e; ++i)
+		p += snprintf(p, e - p, "%c%u", i ? '.' : '-', di->path[i]);
+}
+
+/* Check device against the filter and the table of known devices */
+static int usb_match_dev(const struct usb_match_filter *f,
+			 const struct usb_dev_info *di, int quiet)
+{
+	int known;
+
+	if (f->mask & USB_MATCH_FILTER_BUSNUM && di->busnum != f->busnum)
+		return 0;
+	if (f->mask & USB_MATCH_FILTER_DEVADDR && di->devaddr != f->devaddr)
+		return 0;
+	if (f->mask & USB_MATCH_FILTER_PATH) {
+		if (di->plen < 0 || di->plen < f->plen)
+			return 0;
+		if (f->mask & USB_MATCH_FILTER_PATH_EXACT &&
+		    di->plen != f->plen)
+			return 0;
+		if (memcmp(f->path, di->path, f->plen) != 0)
+			return 0;
+	}
+
+	/* Check against the database of known devices */
+	known = usbdb_lookup(di->vid, di->pid) != NULL;
+
+	if (f->mask & USB_MATCH_FILTER_ID) {
+		if (di->vid != f->vid || di->pid != f->pid)
+			return 0;
+		if (!known && !quiet)
+			fprintf(stderr, "usbcon: device bus=%u,addr=%u,vid=%04x,pid=%04x has unknown VID/PID, but match is forced by the filter\n",
+				di->busnum, di->devaddr, di->vid, di->pid);
+	} else if (!known) {
+		if (f->mask && !quiet)	/* Have at least one filter */
+			fprintf(stderr, "usbcon: device bus=%u,addr=%u,vid=%04x,pid=%04x has unknown VID/PID and will be skipped\n",
+				di->busnum, di->devaddr, di->vid, di->pid);
+		return 0;
+	}
+
+	return 1;
+}
+
+#define USB_SYSFS_DEVICES	"/sys/bus/usb/devices"
+
+/* Candidates bitmap indexed by the bus number and the device address */
+#define USB_CAND_IDX(__bus, __addr)	((__bus) << 7 | ((__addr) & 0x7f))
+#define USB_CAND_SET(__c, __bus, __addr)				\
+	((__c)[USB_CAND_IDX(__bus, __addr) / 32] |=			\
+	 1U << USB_CAND_IDX(__bus, __addr) % 32)
+#define USB_CAND_TEST(__c, __bus, __addr)				\
+	((__c)[USB_CAND_IDX(__bus, __addr) / 32] &			\
+	 1U << USB_CAND_IDX(__bus, __addr) % 32)
+#define USB_CAND_WORDS		(USB_CAND_IDX(0xff, 0x7f) / 32 + 1)
+
+static int usb_sysfs_read_attr(const char *dev, const char *attr, int base,
+			       unsigned *val)
+{
+	char path[0x100], buf[0x10], *end;
+	int fd, res;
+
+	snprintf(path, sizeof(path), USB_SYSFS_DEVICES "/%s/%s", dev, attr);
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	res = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (res <= 0)
+		return -1;
+	buf[res] = '\0';
+
+	*val = strtoul(buf, &end, base);
+
+	return end == buf ? -1 : 0;
+}
+
+/**
+ * Parse sysfs device name into a bus number and a ports path. Root hubs are
+ * named as 'usb<busnum>', other devices are named as '<busnum>-<port>[.<port>
+ * [...]]'. Interfaces (names with a colon) are rejected.
+ */
+static int usb_sysfs_parse_name(const char *name, struct usb_dev_info *di)
+{
+	unsigned long v;
+	char *end;
+
+	if (strchr(name, ':'))
+		return -1;
+
+	if (strncmp(name, "usb", 3) == 0) {
+		v = strtoul(name + 3, &end, 10);
+		if (end == name + 3 || *end != '\0' || v > 0xff)
+			return -1;
+		di->busnum = v;
+		di->plen = 0;
+		return 0;
+	}
+
+	v = strtoul(name, &end, 10);
+	if (end == name || *end != '-' || v > 0xff)
+		return -1;
+	di->busnum = v;
+
+	di->plen = 0;
+	do {
+		name = end + 1;
+		v = strtoul(name, &end, 10);
+		if (end == name || (*end != '.' && *end != '\0') || v > 0xff)
+			return -1;
+		if (di->plen >= ARRAY_SIZE(di->path)) {
+			di->plen = -1;	/* Too long to be matched */
+			return 0;
+		}
+		di->path[di->plen++] = v;
+	} while (*end != '\0');
+
+	return 0;
+}
+
+/**
+ * Evaluate the filter against sysfs device attributes to preselect matching
+ * devices without fetching a descriptor of each USB device in the system. A
+ * bus number and a path are extracted from the directory entry name, so the
+ * attribute files are read only for devices that passed the location check.
+ * Returns a number of found candidates or a negative value if sysfs is not
+ * available.
+ */
+static int usb_sysfs_prematch(const struct usb_match_filter *f,
+			      uint32_t *cands)
+{
+	struct usb_dev_info di;
+	struct dirent *de;
+	unsigned v1, v2;
+	int ncands = 0;
+	DIR *dir;
+
+	dir = opendir(USB_SYSFS_DEVICES);
+	if (!dir)
+		return -1;
+
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		if (usb_sysfs_parse_name(de->d_name, &di))
+			continue;
+
+		if (f->mask & USB_MATCH_FILTER_BUSNUM &&
+		    di.busnum != f->busnum)
+			continue;
+		if (f->mask & USB_MATCH_FILTER_PATH) {
+			if (di.plen < 0) {
+				fprintf(stderr, "usbcon: device %s has path length greater than %d elements and will be skipped\n",
+					de->d_name, (int)ARRAY_SIZE(di.path));
+				continue;
+			}
+			if (di.plen < f->plen)
+				continue;
+			if (memcmp(f->path, di.path, f->plen) != 0)
+				continue;
+		}
+
+		if (usb_sysfs_read_attr(de->d_name, "devnum", 10, &v1) ||
+		    v1 > 0x7f)
+			continue;
+		di.devaddr = v1;
+		if (usb_sysfs_read_attr(de->d_name, "idVendor", 16, &v1) ||
+		    usb_sysfs_read_attr(de->d_name, "idProduct", 16, &v2))
+			continue;
+		di.vid = v1;
+		di.pid = v2;
+
+		if (!usb_match_dev(f, &di, 0))
+			continue;
+
+		USB_CAND_SET(cands, di.busnum, di.devaddr);
+		ncands++;
+	}
+
+	closedir(dir);
+
+	return ncands;
+}
+
+#define USB_CACHE_CHECK_SZ	0x20	/* Size of cache validation block */
+
+/**
+ * Build cache file name from the device identity: VID/PID, bus path and
+ * serial number string. Unsafe serial number symbols are replaced.
+ */
+static void usb_cache_fname(struct main_ctx *mc, const struct usb_dev_info *di,
+			    char *buf, size_t bufsz)
+{
+	struct usb_priv *upd = mc->con_priv;
+	unsigned char serial[0x40];
+	char *p = buf, *e = buf + bufsz;
+	int i, res = 0;
+
+	if (di->iserial)
+		res = libusb_get_string_descriptor_ascii(upd->udh, di->iserial,
+							 serial,
+							 sizeof(serial));
+	if (res <= 0)
+		res = snprintf((char *)serial, sizeof(serial), "noserial");
+	for (i = 0; i < res; ++i)
+		if (!isalnum(serial[i]) && serial[i] != '-')
+			serial[i] = '_';
+	serial[res] = '\0';
+
+	p += snprintf(p, e - p, "%s/%04x-%04x-%u", mc->cache_dir, di->vid,
+		      di->pid, di->busnum);
+	for (i = 0; i < di->plen; ++i)
+		p += snprintf(p, e - p, "%c%u", i ? '.' : '-', di->path[i]);
+	snprintf(p, e - p, "-%s.eep", serial);
+}
+
+/**
+ * Load EEPROM data from the cache file. The cached data are validated by
+ * reading the first EEPROM block from the device. Stale file is removed.
+ */
+static int usb_cache_load(struct main_ctx *mc, const char *fname)
+{
+	uint8_t blk[USB_CACHE_CHECK_SZ];
+	struct stat stat;
+	int fd, res;
+
+	fd = open(fname, O_RDONLY);
+	if (fd == -1)
+		return -1;
+
+	if (fstat(fd, &stat) || stat.st_size < sizeof(blk) ||
+	    stat.st_size > sizeof(mc->eep_buf) || stat.st_size % 2 ||
+	    read(fd, mc->eep_buf, stat.st_size) != stat.st_size) {
+		close(fd);
+		goto drop;
+	}
+	close(fd);
+
+	res = usb_eep_read_block(mc, 0, sizeof(blk), blk);
+	if (res != sizeof(blk))
+		return -1;	/* Do not drop the cache due to a USB glitch */
+	if (memcmp(blk, mc->eep_buf, sizeof(blk)) != 0)
+		goto drop;
+
+	mc->eep_len = stat.st_size;
+
+	return 0;
+
+drop:
+	unlink(fname);
+
+	return -1;
+}
+
+static void usb_cache_save(struct main_ctx *mc, const char *fname)
+{
+	char tmpname[PATH_MAX];
+	int fd, res;
+
+	if (snprintf(tmpname, sizeof(tmpname), "%s.XXXXXX", fname) >=
+	    (int)sizeof(tmpname)) {
+		fprintf(stderr, "usbcon: cache file name '%s' is too long\n",
+			fname);
+		return;
+	}
+	fd = mkstemp(tmpname);
+	if (fd == -1) {
+		fprintf(stderr, "usbcon: unable to create cache file '%s': %s\n",
+			tmpname, strerror(errno));
+		return;
+	}
+	fchmod(fd, 0644);
+
+	res = write(fd, mc->eep_buf, mc->eep_len);
+	close(fd);
+
+	/* Atomically replace a possible stale file */
+	if (res != mc->eep_len || rename(tmpname, fname)) {
+		fprintf(stderr, "usbcon: unable to save cache file '%s'\n",
+			fname);
+		unlink(tmpname);
+	}
+}
+
+/**
+ * Check libusb device against the filter. The device descriptor is fetched
+ * only if the device is a candidate from the sysfs preselection (if any).
+ * Returns 1 on match, 0 on mismatch and a negative value on error.
+ */
+static int usb_check_dev(struct libusb_device *dev,
+			 const struct usb_match_filter *f,
+			 const uint32_t *cands, int ncands,
+			 struct usb_dev_info *di)
+{
+	struct libusb_device_descriptor desc;
+	int res;
+
+	di->busnum = libusb_get_bus_number(dev);
+	di->devaddr = libusb_get_device_address(dev);
+
+	/* Cheap check of the sysfs preselection (if any) */
+	if (ncands > 0 && !USB_CAND_TEST(cands, di->busnum, di->devaddr))
+		return 0;
+
+	res = libusb_get_device_descriptor(dev, &desc);
+	if (res) {
+		fprintf(stderr, "usbcon: unable to get USB device descriptor: %s\n",
+			libusb_strerror(res));
+		return -EIO;
+	}
+	di->vid = desc.idVendor;
+	di->pid = desc.idProduct;
+	di->iserial = desc.iSerialNumber;
+
+	di->plen = libusb_get_port_numbers(dev, di->path, ARRAY_SIZE(di->path));
+	if (di->plen == LIBUSB_ERROR_OVERFLOW) {
+		di->plen = -1;
+		if (f->mask & USB_MATCH_FILTER_PATH) {
+			if (ncands < 0)
+				fprintf(stderr, "usbcon: device bus=%u,addr=%u,vid=%04x,pid=%04x has path length greater than %d elements and will be skipped\n",
+					di->busnum, di->devaddr, di->vid,
+					di->pid, (int)ARRAY_SIZE(di->path));
+			return 0;
+		}
+	} else if (di->plen < 0) {
+		di->plen = -1;
+	}
+
+	/* Warnings are already emitted by the sysfs matcher */
+	return usb_match_dev(f, di, ncands > 0);
+}
+
 static int usb_init(struct main_ctx *mc, const char *arg_str)
 {
 	struct usb_priv *upd = mc->con_priv;
 	struct usb_match_filter filter;
 	struct libusb_device **list = NULL;
-	int list_len, i, j;
+	uint32_t cands[USB_CAND_WORDS];
+	char cache_fname[PATH_MAX];
+	struct usb_dev_info di;
+	int list_len, i, ncands;
 	int res, ret = -EIO;
 
 	res = usb_parse_filter_arg(arg_str, &filter);
@@ -239,6 +802,14 @@ static int usb_init(struct main_ctx *mc, const char *arg_str)
 		return res;
 
 	memset(upd, 0x00, sizeof(*upd));
+	upd->opts = filter.opts;
+
+	memset(cands, 0x00, sizeof(cands));
+	ncands = usb_sysfs_prematch(&filter, cands);
+	if (ncands == 0) {
+		fprintf(stderr, "usbcon: unable to found a matched USB device\n");
+		return -ENODEV;
+	}
 
 	res = libusb_init(&upd->ctx);
 	if (res < 0) {
@@ -247,6 +818,7 @@ static int usb_init(struct main_ctx *mc, const char *arg_str)
 		return -EIO;
 	}
 
+	TRACE0(usb_enum_start);
 	list_len = libusb_get_device_list(upd->ctx, &list);
 	if (list_len < 0) {
 		fprintf(stderr, "usbcon: unable to obtain USB devices list: %s\n",
@@ -255,83 +827,29 @@ static int usb_init(struct main_ctx *mc, const char *arg_str)
 	}
 
 	for (i = 0; i < list_len; ++i) {
-		struct libusb_device_descriptor desc;
-		uint8_t busnum, devaddr;
-		int knownid;
-
-		res = libusb_get_device_descriptor(list[i], &desc);
-		if (res) {
-			fprintf(stderr, "usbcon: unable to get USB device descriptor: %s\n",
-				libusb_strerror(res));
+		res = usb_check_dev(list[i], &filter, cands, ncands, &di);
+		if (res < 0)
 			goto error;
-		}
-		busnum = libusb_get_bus_number(list[i]);
-		devaddr = libusb_get_device_address(list[i]);
-
-		if (filter.mask & USB_MATCH_FILTER_BUSNUM &&
-		    busnum != filter.busnum)
-				continue;
-		if (filter.mask & USB_MATCH_FILTER_DEVADDR &&
-		    devaddr != filter.devaddr)
-				continue;
-		if (filter.mask & USB_MATCH_FILTER_PATH) {
-			uint8_t path[ARRAY_SIZE(filter.path)];
-			int plen;
-
-			plen = libusb_get_port_numbers(list[i], path,
-						       ARRAY_SIZE(path));
-			if (plen == LIBUSB_ERROR_OVERFLOW) {
-				fprintf(stderr, "usbcon: device bus=%u,addr=%u,vid=%04x,pid=%04x has path length greater than %d elements and will be skipped\n",
-					busnum, devaddr, desc.idVendor,
-					desc.idProduct, (int)ARRAY_SIZE(path));
-				continue;
-			}
-
-			if (plen < filter.plen)
-				continue;
-			if (filter.mask & USB_MATCH_FILTER_PATH_EXACT &&
-			    plen != filter.plen)
-				continue;
-
-			if (memcmp(filter.path, path, filter.plen) != 0)
-				continue;
-		}
-
-		/* Check against the table of known devices */
-		knownid = -1;
-		for (j = 0; j < ARRAY_SIZE(devs); ++j) {
-			if (desc.idVendor != devs[j].vid ||
-			    desc.idProduct != devs[j].pid)
-				continue;
-			knownid = j;
-			break;
-		}
-
-		if (filter.mask & USB_MATCH_FILTER_ID) {
-			if (desc.idVendor != filter.vid ||
-			    desc.idProduct != filter.pid)
-				continue;
-			if (knownid == -1)
-				fprintf(stderr, "usbcon: device bus=%u,addr=%u,vid=%04x,pid=%04x has unknown VID/PID, but match is forced by the filter\n",
-						busnum, devaddr, desc.idVendor,
-						desc.idProduct);
-		} else if (knownid == -1) {
-			if (filter.mask)	/* Have at least one filter */
-				fprintf(stderr, "usbcon: device bus=%u,addr=%u,vid=%04x,pid=%04x has unknown VID/PID and will be skipped\n",
-						busnum, devaddr, desc.idVendor,
-						desc.idProduct);
-			continue;
-		}
-
-		break;	/* Got a match, break the search loop */
+		if (res)
+			break;	/* Got a match, break the search loop */
 	}
 
+	TRACE2(usb_enum_end, list_len, i);
+
 	if (i == list_len) {
 		fprintf(stderr, "usbcon: unable to found a matched USB device\n");
 		ret = -ENODEV;
 		goto error;
 	}
 
+	upd->dbe = usbdb_lookup(di.vid, di.pid);
+	if (upd->dbe)
+		mc->chip = upd->dbe->chip;
+
+	usb_dev_path(&di, mc->dev_path, sizeof(mc->dev_path));
+	snprintf(mc->dev_model, sizeof(mc->dev_model), "%04x:%04x", di.vid,
+		 di.pid);
+
 	res = libusb_open(list[i], &upd->udh);
 	if (res) {
 		fprintf(stderr, "usbcon: unable to open USB device: %s\n",
@@ -342,9 +860,26 @@ static int usb_init(struct main_ctx *mc, const char *arg_str)
 	libusb_free_device_list(list, list_len);
 	list = NULL;
 
-	res = usb_eep2buf(mc);
-	if (res)
-		goto error;
+	if (mc->cache_dir) {
+		usb_cache_fname(mc, &di, cache_fname, sizeof(cache_fname));
+		if (usb_cache_load(mc, cache_fname) == 0)
+			return 0;
+	}
+
+	if (upd->dbe && upd->dbe->eep_sz) {
+		usb_eep_lazy_init(mc);
+	} else {
+		res = usb_eep2buf(mc);
+		if (res)
+			goto error;
+	}
+
+	if (mc->cache_dir) {
+		/* Cached data should be complete, so fetch everything */
+		if (eep_load(mc, 0, mc->eep_len))
+			goto error;
+		usb_cache_save(mc, cache_fname);
+	}
 
 	return 0;
 
@@ -361,6 +896,12 @@ error:
 void usb_clean(struct main_ctx *mc)
 {
 	struct usb_priv *upd = mc->con_priv;
+	struct con_stats *cs = &mc->cs;
+
+	if (cs->nretries || cs->nresets)
+		fprintf(stderr, "usbcon: %u transfers, %u retries (%u timeouts, %u short reads), %u resets, max latency %u ms\n",
+			cs->nxfers, cs->nretries, cs->ntimeouts, cs->nshort,
+			cs->nresets, (cs->lat_max + 999) / 1000);
 
 	if (upd->udh)
 		libusb_close(upd->udh);
@@ -368,9 +909,200 @@ void usb_clean(struct main_ctx *mc)
 		libusb_exit(upd->ctx);
 }
 
+#define USB_SCAN_READ_SZ	0x10	/* Chip ID, version and MAC address */
+
+struct usb_scan_dev {
+	struct usb_dev_info di;
+	struct libusb_device_handle *udh;
+	struct libusb_transfer *xfer;
+	int *pending;		/* Counter of pending transfers */
+	int res;		/* Read length or negative error code */
+};
+
+static void usb_scan_xfer_cb(struct libusb_transfer *xfer)
+{
+	struct usb_scan_dev *sd = xfer->user_data;
+
+	if (xfer->status == LIBUSB_TRANSFER_COMPLETED)
+		sd->res = xfer->actual_length;
+	else
+		sd->res = -EIO;
+	(*sd->pending)--;
+}
+
+static const char *usb_path_str(const struct usb_dev_info *di)
+{
+	static char buf[0x30];
+	char *p = buf, *e = buf + sizeof(buf);
+	int i;
+
+	p += snprintf(p, e - p, "%u", di->busnum);
+	if (di->plen < 0)
+		snprintf(p, e - p, "/...");
+	for (i = 0; i < di->plen; ++i)
+		p += snprintf(p, e - p, "/%u", di->path[i]);
+
+	return buf;
+}
+
+static void usb_scan_print(struct main_ctx *mc, struct usb_scan_dev *sd)
+{
+	const struct chip_desc *chip;
+	char addr[0x10], ver[0x10];
+	uint16_t val;
+
+	snprintf(addr, sizeof(addr), "%u:%u", sd->di.busnum, sd->di.devaddr);
+	printf("  %-8s %-16s %04x:%04x ", addr, usb_path_str(&sd->di),
+	       sd->di.vid, sd->di.pid);
+
+	if (sd->res < E_MACADDR_47_32 + 2) {
+		printf("<unable to read EEPROM>\n");
+		return;
+	}
+
+	memcpy(mc->eep_buf, libusb_control_transfer_get_data(sd->xfer),
+	       sd->res);
+	mc->eep_len = sd->res;
+	mc->eep_blk_sz = 0;
+
+	val = eep_read_word(mc, E_CHIPID);
+	chip = chip_find(val);
+	printf("%04Xh  %-8s", val, chip ? chip->name : "-");
+	val = eep_read_word(mc, E_VERSION);
+	snprintf(ver, sizeof(ver), "%u.%u", FIELD_GET(E_VERSION_VERSION, val),
+		 FIELD_GET(E_VERSION_REVISION, val));
+	printf(" %-7s %s\n", ver, get_macaddr_str(mc));
+}
+
+/**
+ * Read identification data of all matched devices at once. Each device is
+ * asked for a single small EEPROM block and all transfers are submitted
+ * asynchronously, so a total scan time is close to a single transfer time.
+ */
+static int usb_scan(struct main_ctx *mc, const char *arg_str)
+{
+	struct usb_match_filter filter;
+	struct libusb_context *ctx = NULL;
+	struct libusb_device **list = NULL;
+	struct usb_scan_dev *devs = NULL, *sd;
+	uint32_t cands[USB_CAND_WORDS];
+	int list_len = 0, i, n = 0, ncands, pending = 0;
+	int res, ret = -EIO;
+	uint8_t *buf;
+
+	res = usb_parse_filter_arg(arg_str, &filter);
+	if (res)
+		return res;
+
+	memset(cands, 0x00, sizeof(cands));
+	ncands = usb_sysfs_prematch(&filter, cands);
+	if (ncands == 0) {
+		fprintf(stderr, "usbcon: unable to found a matched USB device\n");
+		return -ENODEV;
+	}
+
+	res = libusb_init(&ctx);
+	if (res < 0) {
+		fprintf(stderr, "usbcon: unable to initialize libusb context: %s\n",
+			libusb_strerror(res));
+		return -EIO;
+	}
+
+	list_len = libusb_get_device_list(ctx, &list);
+	if (list_len < 0) {
+		fprintf(stderr, "usbcon: unable to obtain USB devices list: %s\n",
+			libusb_strerror(list_len));
+		list = NULL;
+		goto exit;
+	}
+
+	devs = calloc(list_len, sizeof(*devs));
+	if (!devs) {
+		fprintf(stderr, "usbcon: unable to allocate memory for devices list\n");
+		goto exit;
+	}
+
+	for (i = 0; i < list_len; ++i) {
+		sd = &devs[n];
+		res = usb_check_dev(list[i], &filter, cands, ncands, &sd->di);
+		if (res < 0)
+			goto exit;
+		if (!res)
+			continue;
+		n++;
+
+		sd->res = -EIO;
+		sd->pending = &pending;
+		res = libusb_open(list[i], &sd->udh);
+		if (res) {
+			fprintf(stderr, "usbcon: unable to open USB device %u:%u: %s\n",
+				sd->di.busnum, sd->di.devaddr,
+				libusb_strerror(res));
+			sd->udh = NULL;
+			continue;
+		}
+
+		sd->xfer = libusb_alloc_transfer(0);
+		buf = malloc(LIBUSB_CONTROL_SETUP_SIZE + USB_SCAN_READ_SZ);
+		if (!sd->xfer || !buf) {
+			fprintf(stderr, "usbcon: unable to allocate USB transfer\n");
+			free(buf);
+			goto exit;
+		}
+		libusb_fill_control_setup(buf, USB_VENDOR_REQ_IN,
+					  USB_VENDOR_EEP_READ, 0, E_CHIPID,
+					  USB_SCAN_READ_SZ);
+		libusb_fill_control_transfer(sd->xfer, sd->udh, buf,
+					     usb_scan_xfer_cb, sd, 300);
+		sd->xfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+
+		res = libusb_submit_transfer(sd->xfer);
+		if (res) {
+			fprintf(stderr, "usbcon: unable to submit USB transfer: %s\n",
+				libusb_strerror(res));
+			continue;
+		}
+		pending++;
+	}
+
+	while (pending > 0) {
+		res = libusb_handle_events_completed(ctx, NULL);
+		if (res < 0) {
+			fprintf(stderr, "usbcon: unable to handle USB events: %s\n",
+				libusb_strerror(res));
+			goto exit;
+		}
+	}
+
+	printf("  %-8s %-16s %-9s %-6s %-8s %-7s %s\n", "Address", "Path",
+	       "VID:PID", "ChipID", "Chip", "Version", "MacAddr");
+	for (i = 0; i < n; ++i)
+		usb_scan_print(mc, &devs[i]);
+
+	ret = 0;
+
+exit:
+	/* NB: transfers could not be freed while they are still pending */
+	for (i = 0; devs && i < n && !pending; ++i) {
+		if (devs[i].xfer)
+			libusb_free_transfer(devs[i].xfer);
+		if (devs[i].udh)
+			libusb_close(devs[i].udh);
+	}
+	free(devs);
+	if (list)
+		libusb_free_device_list(list, list_len);
+	if (!pending)
+		libusb_exit(ctx);
+
+	return ret;
+}
+
 const struct connector_desc con_usb = {
 	.name = "USB",
 	.priv_sz = sizeof(struct usb_priv),
 	.init = usb_init,
 	.clean = usb_clean,
+	.fetch = usb_eep_fetch,
+	.scan = usb_scan,
 };
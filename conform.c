@@ -0,0 +1,347 @@
+/**
+ * Regulatory limits conformance check
+ *
+ * Copyright (c) 2016-2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "mtkeepmgr.h"
+#include "field.h"
+#include "corpus.h"
+#include "utils.h"
+
+#define LIM_NONE		INT16_MAX
+#define LIM_REGION_ANY		0x100		/* Wildcard region index */
+
+/* Limit of a specific rate and/or bandwidth within a channels range */
+struct lim_rule {
+	uint8_t ch_lo, ch_hi;
+	unsigned bw;			/* 0 - any */
+	char rate[0x10];		/* Empty - any */
+	int16_t lim;			/* 0.5 dBm */
+};
+
+/* Limits of a band in a region */
+struct lim_tbl {
+	int16_t def[0x100];		/* Per channel limit of any rate & bw */
+	struct lim_rule *rules;
+	unsigned nrules;
+};
+
+struct lim_db {
+	struct lim_tbl *tbl[2][LIM_REGION_ANY + 1];	/* [band][region] */
+};
+
+struct conform_ctx {
+	const char *fname;
+	const struct lim_tbl *tbl[2];	/* Unit tables for 2.4 & 5 GHz */
+	unsigned nviol;			/* Unit violations */
+	int worst;			/* Worst margin of all units, 0.5 dB */
+};
+
+/* Convert dBm to 0.5 dBm units */
+static int lim_round(double lim)
+{
+	return lim < 0 ? (int)(lim * 2 - 0.5) : (int)(lim * 2 + 0.5);
+}
+
+static int lim_band_idx(unsigned band)
+{
+	return band == 2 ? 0 : band == 5 ? 1 : -1;
+}
+
+static struct lim_tbl *lim_tbl_get(struct lim_db *db, int bi, unsigned region)
+{
+	struct lim_tbl *t = db->tbl[bi][region];
+	unsigned i;
+
+	if (t)
+		return t;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+	for (i = 0; i < ARRAY_SIZE(t->def); ++i)
+		t->def[i] = LIM_NONE;
+	db->tbl[bi][region] = t;
+
+	return t;
+}
+
+static void lim_db_free(struct lim_db *db)
+{
+	unsigned bi, ri;
+
+	for (bi = 0; bi < 2; ++bi) {
+		for (ri = 0; ri <= LIM_REGION_ANY; ++ri) {
+			if (!db->tbl[bi][ri])
+				continue;
+			free(db->tbl[bi][ri]->rules);
+			free(db->tbl[bi][ri]);
+		}
+	}
+}
+
+/**
+ * Limits file line format:
+ *   <band> <region> <channels> <bw> <rate> <limit>
+ * where <band> is 2 or 5, <region> is a country region code as stored in
+ * EEPROM or '*', <channels> is a channel or a range (e.g. 36-64), <bw> is
+ * a bandwidth in MHz or '*', <rate> is a rate group name (see txpower
+ * action output) or '*' and <limit> is a maximum power in dBm.
+ */
+static int lim_db_load(struct lim_db *db, const char *fname)
+{
+	char line[0x100], region[0x10], chans[0x10], bw[0x10], rate[0x10];
+	unsigned band, region_idx, ch_lo, ch_hi, lineno = 0, i;
+	struct lim_rule *rule;
+	unsigned long val;
+	char *end;
+	struct lim_tbl *t;
+	double lim;
+	int bi, res = 0;
+	FILE *fp;
+
+	fp = fopen(fname, "r");
+	if (!fp) {
+		res = errno;
+		fprintf(stderr, "conform: unable to open limits file '%s': %s\n",
+			fname, strerror(res));
+		return -res;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if (line[strspn(line, " \t\r\n")] == '\0' ||
+		    line[strspn(line, " \t")] == '#')
+			continue;
+
+		if (sscanf(line, "%u %15s %15s %15s %15s %lf", &band, region,
+			   chans, bw, rate, &lim) != 6)
+			goto err_syntax;
+		bi = lim_band_idx(band);
+		if (bi < 0)
+			goto err_syntax;
+		if (strcmp(region, "*") == 0)
+			region_idx = LIM_REGION_ANY;
+		else if ((val = strtoul(region, &end, 0)) > 0xff ||
+			 *end != '\0' || region[0] == '-')
+			goto err_syntax;
+		else
+			region_idx = val;
+		switch (sscanf(chans, "%u-%u", &ch_lo, &ch_hi)) {
+		case 1:
+			ch_hi = ch_lo;
+			break;
+		case 2:
+			break;
+		default:
+			goto err_syntax;
+		}
+		if (ch_lo > ch_hi || ch_hi > 0xff)
+			goto err_syntax;
+		if (strcmp(bw, "*") == 0)
+			val = 0;
+		else if ((val = strtoul(bw, &end, 10)) == 0 || *end != '\0' ||
+			 val > 0xffff)
+			goto err_syntax;
+
+		t = lim_tbl_get(db, bi, region_idx);
+		if (!t) {
+			res = -ENOMEM;
+			break;
+		}
+
+		if (strcmp(bw, "*") == 0 && strcmp(rate, "*") == 0) {
+			for (i = ch_lo; i <= ch_hi; ++i)
+				t->def[i] = lim_round(lim);
+			continue;
+		}
+
+		rule = realloc(t->rules, (t->nrules + 1) * sizeof(*rule));
+		if (!rule) {
+			res = -ENOMEM;
+			break;
+		}
+		t->rules = rule;
+		rule = &t->rules[t->nrules++];
+		rule->ch_lo = ch_lo;
+		rule->ch_hi = ch_hi;
+		rule->bw = val;
+		snprintf(rule->rate, sizeof(rule->rate), "%s",
+			 strcmp(rate, "*") == 0 ? "" : rate);
+		rule->lim = lim_round(lim);
+	}
+
+	fclose(fp);
+
+	return res;
+
+err_syntax:
+	fprintf(stderr, "conform: %s:%u: invalid limit specification\n",
+		fname, lineno);
+	fclose(fp);
+
+	return -EINVAL;
+}
+
+/* The most specific matching rule wins, the last one among equals */
+static int lim_lookup(const struct lim_tbl *t, const struct txpwr_point *pt)
+{
+	const struct lim_rule *r, *best = NULL;
+	int prio, best_prio = -1;
+
+	for (r = t->rules; r < t->rules + t->nrules; ++r) {
+		if (pt->chan < r->ch_lo || pt->chan > r->ch_hi)
+			continue;
+		if (r->bw && r->bw != pt->bw)
+			continue;
+		if (r->rate[0] && strcasecmp(r->rate, pt->rate) != 0)
+			continue;
+		prio = !!r->bw + !!r->rate[0] * 2;
+		if (prio >= best_prio) {
+			best = r;
+			best_prio = prio;
+		}
+	}
+
+	return best ? best->lim : t->def[pt->chan];
+}
+
+static void conform_point(const struct txpwr_point *pt, void *priv)
+{
+	struct conform_ctx *cc = priv;
+	const struct lim_tbl *t = cc->tbl[lim_band_idx(pt->band)];
+	int lim, margin;
+	char buf[0x8];
+
+	if (!t || pt->chan >= ARRAY_SIZE(t->def))
+		return;
+	lim = lim_lookup(t, pt);
+	if (lim == LIM_NONE)
+		return;
+
+	margin = lim - pt->pwr;
+	if (margin < cc->worst)
+		cc->worst = margin;
+	if (margin >= 0)
+		return;
+
+	printf("%s: %s GHz ch %3u %2u MHz %-6s: %4s dBm, ", cc->fname,
+	       pt->band == 2 ? "2.4" : "5", pt->chan, pt->bw, pt->rate,
+	       half_str(buf, sizeof(buf), pt->pwr, 0));
+	printf("limit %4s dBm, ", half_str(buf, sizeof(buf), lim, 0));
+	printf("margin %s dB\n", half_str(buf, sizeof(buf), margin,
+					   HALF_F_PLUS));
+	cc->nviol++;
+}
+
+/* Find the band limits table for the country region code */
+static const struct lim_tbl *conform_tbl(const struct lim_db *db,
+					 struct main_ctx *mc,
+					 const struct chip_desc *chip,
+					 unsigned band)
+{
+	const struct eep_field *f;
+	int bi = lim_band_idx(band);
+	unsigned region;
+
+	f = field_find(chip, band == 2 ? "country.2g" : "country.5g");
+	if (f) {
+		region = field_raw(mc, f);
+		if (db->tbl[bi][region])
+			return db->tbl[bi][region];
+	}
+
+	return db->tbl[bi][LIM_REGION_ANY];
+}
+
+/**
+ * Check effective Tx power of each image of the corpus against the limits
+ * database. Limits are selected by the country region codes of an image.
+ */
+int act_conform(struct main_ctx *mc, int argc, char *argv[])
+{
+	unsigned i, nunits = 0, nfailed = 0, nskipped = 0, nviol = 0;
+	const struct chip_desc *chip;
+	struct conform_ctx cc;
+	struct lim_db db;
+	struct corpus c;
+	int res, worst = LIM_NONE;
+	char buf[0x8];
+
+	if (argc < 2) {
+		fprintf(stderr, "conform: limits file and EEPROM images are required\n");
+		return -EINVAL;
+	}
+
+	memset(&db, 0, sizeof(db));
+	res = lim_db_load(&db, argv[0]);
+	if (res)
+		goto exit;
+
+	res = corpus_init(&c, argc - 1, argv + 1);
+	if (res)
+		goto exit;
+
+	for (i = 0; i < c.nfiles; ++i) {
+		if (corpus_load(mc, c.files[i])) {
+			nskipped++;
+			continue;
+		}
+		chip = chip_find(eep_read_word(mc, E_CHIPID));
+		if (!chip || !chip->txpower_iter) {
+			fprintf(stderr, "conform: %s: unsupported chip (chipid:0x%04x), skipped\n",
+				c.files[i], eep_read_word(mc, E_CHIPID));
+			nskipped++;
+			continue;
+		}
+
+		memset(&cc, 0, sizeof(cc));
+		cc.fname = c.files[i];
+		cc.worst = LIM_NONE;
+		cc.tbl[0] = conform_tbl(&db, mc, chip, 2);
+		cc.tbl[1] = conform_tbl(&db, mc, chip, 5);
+		chip->txpower_iter(mc, conform_point, &cc);
+
+		nunits++;
+		nviol += cc.nviol;
+		if (cc.nviol)
+			nfailed++;
+		if (cc.worst < worst)
+			worst = cc.worst;
+	}
+
+	printf("Units: %u checked, %u failed, %u skipped; violations: %u",
+	       nunits, nfailed, nskipped, nviol);
+	if (worst != LIM_NONE)
+		printf("; worst margin: %s dB",
+		       half_str(buf, sizeof(buf), worst, HALF_F_PLUS));
+	printf("\n");
+
+	corpus_free(&c);
+
+	res = nfailed || nskipped ? -1 : 0;
+
+exit:
+	lim_db_free(&db);
+
+	return res;
+}
@@ -0,0 +1,727 @@
+/**
+ * EEPROM images corpus (batch) handling
+ *
+ * Copyright (c) 2016-2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "mtkeepmgr.h"
+#include "corpus.h"
+#ifdef CONFIG_IO_URING
+#include "uring.h"
+#endif
+
+static int corpus_add(struct corpus *c, const char *fname)
+{
+	char **files;
+
+	if ((c->nfiles & (c->nfiles - 1)) == 0) {	/* Grow by power of 2 */
+		files = realloc(c->files, (c->nfiles ? c->nfiles * 2 : 16) *
+					  sizeof(c->files[0]));
+		if (!files)
+			return -ENOMEM;
+		c->files = files;
+	}
+
+	c->files[c->nfiles] = strdup(fname);
+	if (!c->files[c->nfiles])
+		return -ENOMEM;
+	c->nfiles++;
+
+	return 0;
+}
+
+/* Get a directory entry type, avoid the stat() call when d_type is known */
+static unsigned corpus_dirent_type(const char *path, const struct dirent *de)
+{
+	struct stat st;
+
+	if (de->d_type != DT_UNKNOWN && de->d_type != DT_LNK)
+		return de->d_type;
+	if (stat(path, &st))
+		return DT_UNKNOWN;
+
+	return S_ISDIR(st.st_mode) ? DT_DIR :
+	       S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+}
+
+/* Add regular files of the directory and its subdirectories */
+static int corpus_add_dir(struct corpus *c, const char *dname)
+{
+	char path[0x1000];
+	struct dirent *de;
+	unsigned type;
+	int res = 0;
+	DIR *dir;
+
+	dir = opendir(dname);
+	if (!dir) {
+		res = errno;
+		fprintf(stderr, "corpus: unable to open directory '%s': %s\n",
+			dname, strerror(res));
+		return -res;
+	}
+
+	while (!res && (de = readdir(dir))) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dname, de->d_name);
+		type = corpus_dirent_type(path, de);
+		if (type == DT_DIR)
+			res = corpus_add_dir(c, path);
+		else if (type == DT_REG)
+			res = corpus_add(c, path);
+	}
+
+	closedir(dir);
+
+	return res;
+}
+
+static int corpus_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * Build the corpus from the list of files and directories. Directories are
+ * scanned recursively, hidden entries are skipped.
+ */
+int corpus_init(struct corpus *c, int argc, char *argv[])
+{
+	struct stat st;
+	int i, res;
+
+	c->files = NULL;
+	c->nfiles = 0;
+	c->walk = NULL;
+
+	for (i = 0; i < argc; ++i) {
+		if (stat(argv[i], &st)) {
+			fprintf(stderr, "corpus: unable to stat '%s': %s\n",
+				argv[i], strerror(errno));
+			res = -errno;
+			goto err;
+		}
+		if (S_ISDIR(st.st_mode))
+			res = corpus_add_dir(c, argv[i]);
+		else
+			res = corpus_add(c, argv[i]);
+		if (res)
+			goto err;
+	}
+
+	if (!c->nfiles) {
+		fprintf(stderr, "corpus: no EEPROM images specified\n");
+		return -ENOENT;
+	}
+
+	qsort(c->files, c->nfiles, sizeof(c->files[0]), corpus_cmp);
+
+	return 0;
+
+err:
+	corpus_free(c);
+
+	return res;
+}
+
+/* Opened directory of a streamed corpus walk */
+struct corpus_walk_dir {
+	DIR *dir;
+	size_t plen;			/* Directory path length */
+};
+
+/**
+ * Streamed corpus walk state. Directories are read incrementally, while the
+ * found images are processed, so only the stack of opened directories is
+ * kept. The walk is shared by the worker threads and protected by the lock.
+ */
+struct corpus_walk {
+	pthread_mutex_t lock;
+	char **roots;			/* Listed files and directories */
+	unsigned nroots;
+	unsigned root;			/* Next listed entry */
+	struct corpus_walk_dir *dirs;	/* Stack of opened directories */
+	unsigned depth;
+	unsigned maxdepth;		/* Allocated stack size */
+	int err;			/* Walk failure, stops the walk */
+	char path[PATH_MAX];		/* Path of the innermost directory */
+};
+
+/**
+ * Prepare the corpus to be walked incrementally by corpus_run(). Unlike
+ * corpus_init() the memory usage does not depend on the corpus size, but
+ * images are processed in the directory order and their number is known
+ * only after the run.
+ */
+int corpus_init_stream(struct corpus *c, int argc, char *argv[])
+{
+	struct stat st;
+	int i, res;
+
+	c->files = NULL;
+	c->nfiles = 0;
+	c->walk = NULL;
+
+	if (!argc) {
+		fprintf(stderr, "corpus: no EEPROM images specified\n");
+		return -ENOENT;
+	}
+
+	for (i = 0; i < argc; ++i) {
+		if (stat(argv[i], &st)) {
+			res = errno;
+			fprintf(stderr, "corpus: unable to stat '%s': %s\n",
+				argv[i], strerror(res));
+			return -res;
+		}
+	}
+
+	c->walk = calloc(1, sizeof(*c->walk));
+	if (!c->walk)
+		return -ENOMEM;
+	pthread_mutex_init(&c->walk->lock, NULL);
+	c->walk->roots = argv;
+	c->walk->nroots = argc;
+
+	return 0;
+}
+
+static int corpus_walk_push(struct corpus_walk *w, const char *path)
+{
+	struct corpus_walk_dir *dirs;
+	unsigned n;
+	DIR *dir;
+	int res;
+
+	if (w->depth == w->maxdepth) {
+		n = w->maxdepth ? w->maxdepth * 2 : 8;
+		dirs = realloc(w->dirs, n * sizeof(*dirs));
+		if (!dirs)
+			return -ENOMEM;
+		w->dirs = dirs;
+		w->maxdepth = n;
+	}
+
+	dir = opendir(path);
+	if (!dir) {
+		res = errno;
+		fprintf(stderr, "corpus: unable to open directory '%s': %s\n",
+			path, strerror(res));
+		return -res;
+	}
+
+	w->dirs[w->depth].dir = dir;
+	w->dirs[w->depth].plen = strlen(path);
+	w->depth++;
+	if (path != w->path)
+		memcpy(w->path, path, w->dirs[w->depth - 1].plen + 1);
+
+	return 0;
+}
+
+static void corpus_walk_pop(struct corpus_walk *w)
+{
+	closedir(w->dirs[--w->depth].dir);
+	if (w->depth)
+		w->path[w->dirs[w->depth - 1].plen] = '\0';
+}
+
+/**
+ * Find the next image of a streamed corpus. The image path is placed to the
+ * buffer of PATH_MAX size. Returns zero and the image index on success or
+ * -ENOENT at the end of the walk.
+ */
+static int corpus_walk_next(struct corpus *c, char *path, unsigned *idx)
+{
+	struct corpus_walk *w = c->walk;
+	struct dirent *de;
+	struct stat st;
+	unsigned type;
+	int len, res = -ENOENT;
+
+	pthread_mutex_lock(&w->lock);
+	while (!w->err) {
+		if (w->depth) {
+			de = readdir(w->dirs[w->depth - 1].dir);
+			if (!de) {
+				corpus_walk_pop(w);
+				continue;
+			}
+			if (de->d_name[0] == '.')
+				continue;
+			len = snprintf(path, PATH_MAX, "%s/%s", w->path,
+				       de->d_name);
+			if (len >= PATH_MAX)
+				goto err_toolong;
+			type = corpus_dirent_type(path, de);
+		} else if (w->root < w->nroots) {
+			len = snprintf(path, PATH_MAX, "%s",
+				       w->roots[w->root++]);
+			if (len >= PATH_MAX)
+				goto err_toolong;
+			type = stat(path, &st) == 0 && S_ISDIR(st.st_mode) ?
+			       DT_DIR : DT_REG;
+		} else {
+			break;
+		}
+
+		if (type == DT_DIR) {
+			w->err = corpus_walk_push(w, path);
+		} else if (type == DT_REG) {
+			*idx = c->nfiles++;
+			res = 0;
+			break;
+		}
+		continue;
+
+err_toolong:
+		fprintf(stderr, "corpus: path '%.64s...' is too long\n", path);
+		w->err = -ENAMETOOLONG;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return res;
+}
+
+void corpus_free(struct corpus *c)
+{
+	unsigned i;
+
+	for (i = 0; i < c->nfiles && c->files; ++i)
+		free(c->files[i]);
+	free(c->files);
+	c->files = NULL;
+	c->nfiles = 0;
+
+	if (c->walk) {
+		while (c->walk->depth)
+			corpus_walk_pop(c->walk);
+		free(c->walk->dirs);
+		pthread_mutex_destroy(&c->walk->lock);
+		free(c->walk);
+		c->walk = NULL;
+	}
+}
+
+/* Finish an image loading, when the data is already in the buffer */
+static void corpus_loaded(struct main_ctx *mc, size_t len)
+{
+	mc->eep_len = len & ~1;
+	mc->eep_blk_sz = 0;
+	mc->eep_err = 0;
+	mc->chip = NULL;
+
+	eep_normalize(mc);
+}
+
+/**
+ * Read an image file to the context buffer. Returns the read size or a
+ * negative error code. If the exact flag is set, then files bigger than
+ * the buffer are rejected instead of being truncated.
+ */
+static ssize_t corpus_read_file(struct main_ctx *mc, const char *fname,
+				int exact)
+{
+	ssize_t res;
+	uint8_t tail;
+	int fd, err;
+
+	fd = open(fname, O_RDONLY);
+	if (fd == -1) {
+		err = errno;
+		fprintf(stderr, "corpus: unable to open '%s': %s\n", fname,
+			strerror(err));
+		return -err;
+	}
+
+	res = read(fd, mc->eep_buf, sizeof(mc->eep_buf));
+	if (res < 0) {
+		fprintf(stderr, "corpus: unable to read '%s': %s\n", fname,
+			strerror(errno));
+		res = -EIO;
+	} else if (exact && res == sizeof(mc->eep_buf) &&
+		   read(fd, &tail, 1) != 0) {
+		fprintf(stderr, "corpus: '%s' is bigger than %zu bytes\n",
+			fname, sizeof(mc->eep_buf));
+		res = -EFBIG;
+	}
+	close(fd);
+
+	return res;
+}
+
+/* Load a corpus image to the context, which has no connector */
+int corpus_load(struct main_ctx *mc, const char *fname)
+{
+	ssize_t res;
+
+	res = corpus_read_file(mc, fname, 0);
+	if (res < 0)
+		return res;
+
+	corpus_loaded(mc, res);
+
+	return 0;
+}
+
+/**
+ * Load an image exactly as it is stored: no normalization and an odd size
+ * is kept. The byte following the image (if any) is set to 0xff, so the
+ * last word of an odd sized image is well defined.
+ */
+int corpus_load_raw(struct main_ctx *mc, const char *fname)
+{
+	ssize_t res;
+
+	res = corpus_read_file(mc, fname, 1);
+	if (res < 0)
+		return res;
+
+	if (res < sizeof(mc->eep_buf))
+		mc->eep_buf[res] = 0xff;
+	mc->eep_len = res;
+	mc->eep_raw_len = res;
+	mc->eep_norm = 0;
+	mc->eep_blk_sz = 0;
+	mc->eep_err = 0;
+	mc->chip = NULL;
+
+	return 0;
+}
+
+struct corpus_run_ctx {
+	struct corpus *c;
+	int (*cb)(struct main_ctx *mc, unsigned idx, unsigned tidx, void *priv);
+	void *priv;
+	unsigned next;			/* Next file index */
+	unsigned nskipped;
+};
+
+struct corpus_thread {
+	struct corpus_run_ctx *rc;
+	unsigned idx;
+	pthread_t tid;
+};
+
+/**
+ * Get the next image to process. Images of a listed corpus are distributed
+ * through the atomic index, a streamed corpus is walked further. Returns
+ * the image path (could be placed to the buffer of PATH_MAX size) or NULL
+ * if there are no more images.
+ */
+static const char *corpus_next(struct corpus_run_ctx *rc, char *buf,
+			       unsigned *idx)
+{
+	struct corpus *c = rc->c;
+
+	if (c->walk)
+		return corpus_walk_next(c, buf, idx) ? NULL : buf;
+
+	*idx = __atomic_fetch_add(&rc->next, 1, __ATOMIC_RELAXED);
+
+	return *idx < c->nfiles ? c->files[*idx] : NULL;
+}
+
+#ifdef CONFIG_IO_URING
+#define CORPUS_URING_DEPTH	16	/* Images in flight per worker */
+
+#define CORPUS_OP_OPEN		0
+#define CORPUS_OP_READ		1
+#define CORPUS_OP_CLOSE		2	/* Also unused SQE */
+#define CORPUS_UD(__slot, __op)	((uint64_t)(__slot) << 2 | (__op))
+
+struct corpus_slot {
+	struct main_ctx mc;
+	unsigned idx;			/* Image in flight */
+	const char *fname;		/* Image file name */
+	int fd;				/* Opened image file */
+	char path[PATH_MAX];		/* Streamed corpus image path */
+};
+
+/* Pass a read image to the callback, a negative res is a read error */
+static void corpus_slot_done(struct corpus_thread *ct, struct corpus_slot *slot,
+			     int res)
+{
+	struct corpus_run_ctx *rc = ct->rc;
+
+	if (res < 0) {
+		fprintf(stderr, "corpus: unable to read '%s': %s\n",
+			slot->fname, strerror(-res));
+	} else {
+		corpus_loaded(&slot->mc, res);
+		res = rc->cb(&slot->mc, slot->idx, ct->idx, rc->priv);
+	}
+	if (res)
+		__atomic_fetch_add(&rc->nskipped, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Load images using io_uring. Opens of a whole batch of images are submitted
+ * at once, each completed open is followed by a read directly to the slot
+ * context buffer (registered once if possible) and by a hard linked close.
+ * So a batch costs a couple of io_uring_enter() calls instead of three
+ * system calls per image. Returns -1 if io_uring is unusable (old kernel,
+ * seccomp, etc.) or failed, then the caller should process the rest of
+ * images using the plain path.
+ */
+static int corpus_worker_uring(struct corpus_thread *ct)
+{
+	static const uint8_t ops[] = {IORING_OP_OPENAT, IORING_OP_READ,
+				      IORING_OP_READ_FIXED, IORING_OP_CLOSE};
+	struct corpus_run_ctx *rc = ct->rc;
+	struct iovec iov[CORPUS_URING_DEPTH];
+	unsigned freeslots[CORPUS_URING_DEPTH], opened[CORPUS_URING_DEPTH];
+	unsigned i, s, nfree = 0, nops = 0, done = 0;
+	unsigned ohead = 0, nopened = 0;	/* Opened images FIFO */
+	struct corpus_slot *slots, *slot;
+	int fixed, failed = 0, res, ret = -1;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	struct uring r;
+	uint64_t ud;
+
+	if (uring_init(&r, 2 * CORPUS_URING_DEPTH))
+		return -1;
+	if (uring_probe(&r, ops, sizeof(ops)/sizeof(ops[0])))
+		goto exit_ring;
+
+	slots = calloc(CORPUS_URING_DEPTH, sizeof(*slots));
+	if (!slots)
+		goto exit_ring;
+	for (i = 0; i < CORPUS_URING_DEPTH; ++i) {
+		iov[i].iov_base = slots[i].mc.eep_buf;
+		iov[i].iov_len = sizeof(slots[i].mc.eep_buf);
+		freeslots[nfree++] = i;
+	}
+	/* Registration could fail due to RLIMIT_MEMLOCK, use plain reads then */
+	fixed = uring_register_buffers(&r, iov, CORPUS_URING_DEPTH) == 0;
+
+	ret = 0;
+	do {
+		/* Reads of opened images go first, they free slots */
+		while (!failed && nopened && uring_sq_space(&r) >= 2) {
+			s = opened[ohead];
+			ohead = (ohead + 1) % CORPUS_URING_DEPTH;
+			nopened--;
+			slot = &slots[s];
+			sqe = uring_get_sqe(&r);
+			sqe->opcode = fixed ? IORING_OP_READ_FIXED :
+					      IORING_OP_READ;
+			sqe->fd = slot->fd;
+			sqe->addr = (uintptr_t)slot->mc.eep_buf;
+			sqe->len = sizeof(slot->mc.eep_buf);
+			sqe->buf_index = s;
+			sqe->flags = IOSQE_IO_HARDLINK;
+			sqe->user_data = CORPUS_UD(s, CORPUS_OP_READ);
+			sqe = uring_get_sqe(&r);
+			sqe->opcode = IORING_OP_CLOSE;
+			sqe->fd = slot->fd;
+			sqe->user_data = CORPUS_UD(0, CORPUS_OP_CLOSE);
+			nops += 2;
+		}
+
+		while (!failed && !done && nfree &&
+		       (sqe = uring_get_sqe(&r)) != NULL) {
+			s = freeslots[nfree - 1];
+			slot = &slots[s];
+			slot->fname = corpus_next(rc, slot->path, &slot->idx);
+			nops++;
+			if (!slot->fname) {
+				sqe->opcode = IORING_OP_NOP;
+				sqe->user_data = CORPUS_UD(0, CORPUS_OP_CLOSE);
+				done = 1;
+				break;
+			}
+			nfree--;
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (uintptr_t)slot->fname;
+			sqe->open_flags = O_RDONLY;
+			sqe->user_data = CORPUS_UD(s, CORPUS_OP_OPEN);
+		}
+
+		/* Nothing to wait for, opened images are finished below */
+		if (!nops)
+			break;
+
+		res = uring_submit_wait(&r, 1);
+		if (res && !failed) {
+			/* Stop submitting and wait for requests in flight */
+			fprintf(stderr, "corpus: io_uring failure: %s\n",
+				strerror(-res));
+			failed = 1;
+			ret = -1;
+			continue;
+		} else if (res) {
+			/* Requests in flight could still use the slots memory */
+			fprintf(stderr, "corpus: unable to wait for io_uring requests: %s\n",
+				strerror(-res));
+			failed = 2;
+			break;
+		}
+
+		while ((cqe = uring_peek_cqe(&r)) != NULL) {
+			ud = cqe->user_data;
+			res = cqe->res;
+			uring_cqe_seen(&r);
+			nops--;
+
+			s = ud >> 2;
+			slot = &slots[s];
+			switch (ud & 3) {
+			case CORPUS_OP_OPEN:
+				if (res < 0) {
+					fprintf(stderr, "corpus: unable to open '%s': %s\n",
+						slot->fname, strerror(-res));
+					__atomic_fetch_add(&rc->nskipped, 1,
+							   __ATOMIC_RELAXED);
+					freeslots[nfree++] = s;
+					break;
+				}
+				slot->fd = res;
+				opened[(ohead + nopened++) % CORPUS_URING_DEPTH] = s;
+				break;
+			case CORPUS_OP_READ:
+				corpus_slot_done(ct, slot, res);
+				freeslots[nfree++] = s;
+				break;
+			}
+		}
+	} while (nops || (!done && !failed));
+
+	/* Images, which were opened but not read due to a failure */
+	for (; nopened; --nopened, ohead = (ohead + 1) % CORPUS_URING_DEPTH) {
+		slot = &slots[opened[ohead]];
+		res = read(slot->fd, slot->mc.eep_buf, sizeof(slot->mc.eep_buf));
+		corpus_slot_done(ct, slot, res < 0 ? -errno : res);
+		close(slot->fd);
+	}
+
+	if (failed != 2)
+		free(slots);
+
+exit_ring:
+	uring_free(&r);
+
+	return ret;
+}
+#endif
+
+static void *corpus_worker(void *arg)
+{
+	struct corpus_thread *ct = arg;
+	struct corpus_run_ctx *rc = ct->rc;
+	char path[PATH_MAX];
+	struct main_ctx *mc;
+	const char *fname;
+	unsigned idx;
+
+#ifdef CONFIG_IO_URING
+	if (corpus_worker_uring(ct) == 0)
+		return NULL;
+#endif
+
+	mc = calloc(1, sizeof(*mc));
+	if (!mc)
+		return NULL;
+
+	while ((fname = corpus_next(rc, path, &idx)) != NULL) {
+		if (corpus_load(mc, fname) ||
+		    rc->cb(mc, idx, ct->idx, rc->priv))
+			__atomic_fetch_add(&rc->nskipped, 1, __ATOMIC_RELAXED);
+	}
+
+	free(mc);
+
+	return NULL;
+}
+
+/* Number of threads to process the corpus, 0 - select automatically */
+unsigned corpus_nthreads(const struct corpus *c, long nthreads)
+{
+	if (nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > CORPUS_NTHREADS_MAX)
+		nthreads = CORPUS_NTHREADS_MAX;
+	if (!c->walk && nthreads > c->nfiles)
+		nthreads = c->nfiles;
+
+	return nthreads;
+}
+
+/**
+ * Load each corpus image and pass it to the callback using a pool of
+ * worker threads. Images are distributed dynamically, each callback
+ * invocation gets the image index and the worker thread index. Returns the
+ * number of images, which were failed to load or rejected by the callback,
+ * or a negative error code.
+ */
+int corpus_run(struct corpus *c, unsigned nthreads,
+	       int (*cb)(struct main_ctx *mc, unsigned idx, unsigned tidx,
+			 void *priv),
+	       void *priv)
+{
+	struct corpus_run_ctx rc = {.c = c, .cb = cb, .priv = priv};
+	struct corpus_thread *threads;
+	unsigned t;
+	int res = 0;
+
+	threads = calloc(nthreads, sizeof(*threads));
+	if (!threads)
+		return -ENOMEM;
+
+	for (t = 0; t < nthreads; ++t) {
+		threads[t].rc = &rc;
+		threads[t].idx = t;
+		res = pthread_create(&threads[t].tid, NULL, corpus_worker,
+				     &threads[t]);
+		if (res) {
+			fprintf(stderr, "corpus: unable to start worker thread: %s\n",
+				strerror(res));
+			res = -res;
+			break;
+		}
+	}
+	nthreads = t;
+	for (t = 0; t < nthreads; ++t)
+		pthread_join(threads[t].tid, NULL);
+
+	free(threads);
+
+	if (!res && c->walk && c->walk->err) {
+		res = c->walk->err;
+	} else if (!res && c->walk && !c->nfiles) {
+		fprintf(stderr, "corpus: no EEPROM images specified\n");
+		res = -ENOENT;
+	}
+
+	return res ? res : rc.nskipped;
+}
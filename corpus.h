@@ -0,0 +1,43 @@
+/**
+ * EEPROM images corpus (batch) handling
+ *
+ * Copyright (c) 2016-2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CORPUS_H_
+#define _CORPUS_H_
+
+#define CORPUS_NTHREADS_MAX	64
+
+struct corpus_walk;
+
+struct corpus {
+	char **files;		/* Sorted list of image files, NULL if streamed */
+	unsigned nfiles;	/* Number of files (walked so far if streamed) */
+	struct corpus_walk *walk;	/* Streamed corpus walk state */
+};
+
+int corpus_init(struct corpus *c, int argc, char *argv[]);
+int corpus_init_stream(struct corpus *c, int argc, char *argv[]);
+void corpus_free(struct corpus *c);
+int corpus_load(struct main_ctx *mc, const char *fname);
+int corpus_load_raw(struct main_ctx *mc, const char *fname);
+unsigned corpus_nthreads(const struct corpus *c, long nthreads);
+int corpus_run(struct corpus *c, unsigned nthreads,
+	       int (*cb)(struct main_ctx *mc, unsigned idx, unsigned tidx,
+			 void *priv),
+	       void *priv);
+
+#endif	/* !_CORPUS_H_ */
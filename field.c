@@ -0,0 +1,109 @@
+/**
+ * EEPROM fields handling
+ *
+ * Copyright (c) 2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fnmatch.h>
+
+#include "mtkeepmgr.h"
+#include "utils.h"
+#include "field.h"
+
+/* Fields, which carry per unit calibration results */
+static const char * const field_calib_patterns[] = {
+	"txpwr.*", "ratepwr.*", "pwrdelta.*", "tssi.*", "lna.*", "rssi.*",
+	"freq_offset", "temp_offset",
+};
+
+const struct eep_field *field_find(const struct chip_desc *chip,
+				   const char *name)
+{
+	const struct eep_field *f;
+
+	for_each_field(chip, f)
+		if (strcmp(f->name, name) == 0)
+			return f;
+
+	return NULL;
+}
+
+/* Check whether the field is a calibration one (not an identification) */
+int field_is_calib(const struct eep_field *f)
+{
+	unsigned i;
+
+	if (f->flags & (EEP_FF_MACADDR | EEP_FF_HEX))
+		return 0;
+	for (i = 0; i < ARRAY_SIZE(field_calib_patterns); ++i)
+		if (fnmatch(field_calib_patterns[i], f->name, 0) == 0)
+			return 1;
+
+	return 0;
+}
+
+/* Return field bits shifted to the LSB */
+unsigned field_raw(struct main_ctx *mc, const struct eep_field *f)
+{
+	return (eep_read_word(mc, f->off) & f->mask) >> __builtin_ctz(f->mask);
+}
+
+/* Convert raw field bits to the field value */
+int field_decode(const struct eep_field *f, unsigned raw)
+{
+	unsigned width = __builtin_popcount(f->mask);
+
+	if (f->decode)
+		return f->decode(raw);
+	if (f->flags & EEP_FF_SIGNED && raw & 1U << (width - 1))
+		return (int)raw - (1 << width);
+
+	return raw;
+}
+
+int field_value(struct main_ctx *mc, const struct eep_field *f)
+{
+	return field_decode(f, field_raw(mc, f));
+}
+
+/* Number of EEPROM bytes occupied by the field */
+unsigned field_size(const struct eep_field *f)
+{
+	return f->flags & EEP_FF_MACADDR ? 6 : 2;
+}
+
+char *field_str(struct main_ctx *mc, const struct eep_field *f, char *buf,
+		size_t bufsz)
+{
+	int val;
+
+	if (f->flags & EEP_FF_MACADDR) {
+		snprintf(buf, bufsz, "%s", get_macaddr_str(mc));
+		return buf;
+	}
+
+	val = field_value(mc, f);
+	if (f->flags & EEP_FF_HEX)
+		snprintf(buf, bufsz, "0x%0*x",
+			 (__builtin_popcount(f->mask) + 3) / 4, val);
+	else if (f->flags & EEP_FF_HALF)
+		half_str(buf, bufsz, val, 0);
+	else
+		snprintf(buf, bufsz, "%d", val);
+
+	return buf;
+}
@@ -0,0 +1,35 @@
+/**
+ * EEPROM fields handling
+ *
+ * Copyright (c) 2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _FIELD_H_
+#define _FIELD_H_
+
+#define for_each_field(__chip, __f)					\
+	for (__f = (__chip) ? (__chip)->fields : NULL; __f && __f->name; ++__f)
+
+const struct eep_field *field_find(const struct chip_desc *chip,
+				   const char *name);
+int field_is_calib(const struct eep_field *f);
+unsigned field_raw(struct main_ctx *mc, const struct eep_field *f);
+int field_decode(const struct eep_field *f, unsigned raw);
+int field_value(struct main_ctx *mc, const struct eep_field *f);
+unsigned field_size(const struct eep_field *f);
+char *field_str(struct main_ctx *mc, const struct eep_field *f, char *buf,
+		size_t bufsz);
+
+#endif	/* !_FIELD_H_ */
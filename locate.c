@@ -0,0 +1,187 @@
+/**
+ * Locate EEPROM data inside a full flash image
+ *
+ * Copyright (c) 2016-2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <endian.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mtkeepmgr.h"
+#include "utils.h"
+
+extern const struct connector_desc con_file;
+
+#define LOC_STRIDE_DEF		0x200
+#define LOC_SCORE_MIN_DEF	2
+#define LOC_SCORE_MAX		4
+
+static inline uint16_t loc_read_word(const uint8_t *p, unsigned off)
+{
+	return le16toh(*(const uint16_t *)(p + off));
+}
+
+/**
+ * Evaluate how plausible the EEPROM candidate is. Chip ID match is a
+ * prerequisite, then each sane looking piece of data adds a point.
+ */
+static int loc_score(const uint8_t *p, size_t len)
+{
+	static const uint8_t mac_zero[6], mac_bcast[6] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+	};
+	const uint8_t *mac = p + E_MACADDR_15_00;
+	uint16_t ver = loc_read_word(p, E_VERSION);
+	int score = 0;
+	unsigned i;
+
+	if (ver != 0x0000 && ver != 0xffff)
+		score++;
+
+	if (memcmp(mac, mac_zero, 6) != 0 && memcmp(mac, mac_bcast, 6) != 0) {
+		score++;
+		if (!(mac[0] & 0x01))		/* Unicast address */
+			score++;
+	}
+
+	/* Some data after the header, not an erased flash */
+	for (i = 0x10; i < 0x100 && i < len; ++i)
+		if (p[i] != 0xff && p[i] != 0x00)
+			break;
+	if (i < 0x100 && i < len)
+		score++;
+
+	return score;
+}
+
+static void loc_decode(struct main_ctx *mc, const struct chip_desc *chip,
+		       const uint8_t *p, size_t off, size_t len)
+{
+	mc->eep_len = len < sizeof(mc->eep_buf) ? len : sizeof(mc->eep_buf);
+	mc->eep_len &= ~1;
+	mc->eep_blk_sz = 0;
+	memcpy(mc->eep_buf, p, mc->eep_len);
+
+	printf("\n[EEPROM at offset 0x%08zx (%s)]\n\n", off, chip->name);
+	chip_parse(mc, chip);
+}
+
+/**
+ * Scan a flash image for registered chip IDs at the plausible offsets and
+ * decode each found candidate in place. The image is mmapped, so only the
+ * pages at the candidate offsets are actually read from the storage.
+ */
+int act_locate(struct main_ctx *mc, int argc, char *argv[])
+{
+	unsigned stride = LOC_STRIDE_DEF, nhits = 0;
+	int score_min = LOC_SCORE_MIN_DEF, score;
+	const struct chip_desc *chip;
+	const uint8_t *img;
+	struct stat st;
+	size_t off;
+	int fd, ret = 0;
+
+	if (mc->con != &con_file) {
+		fprintf(stderr, "locate action works only with a flash image file\n");
+		return -EINVAL;
+	}
+
+	if (argc >= 1)
+		stride = strtoul(argv[0], NULL, 0);
+	if (argc >= 2)
+		score_min = strtol(argv[1], NULL, 0);
+	if (!stride || stride % 2) {
+		fprintf(stderr, "Invalid search stride -- %s\n", argv[0]);
+		return -EINVAL;
+	}
+
+	fd = open(mc->con_arg, O_RDONLY);
+	if (fd == -1) {
+		ret = errno;
+		fprintf(stderr, "locate: unable to open flash image '%s': %s\n",
+			mc->con_arg, strerror(ret));
+		return -ret;
+	}
+
+	if (fstat(fd, &st)) {
+		fprintf(stderr, "locate: unable to stat flash image '%s': %s\n",
+			mc->con_arg, strerror(errno));
+		ret = -errno;
+		goto exit_close;
+	}
+	if (st.st_size < E_MACADDR_47_32 + 2) {
+		fprintf(stderr, "locate: flash image '%s' is too small\n",
+			mc->con_arg);
+		ret = -EINVAL;
+		goto exit_close;
+	}
+
+	img = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (img == MAP_FAILED) {
+		fprintf(stderr, "locate: unable to map flash image '%s': %s\n",
+			mc->con_arg, strerror(errno));
+		ret = -errno;
+		goto exit_close;
+	}
+
+	printf("%-10s  %-8s  %-7s  %-17s  %s\n", "Offset", "Chip", "Version",
+	       "MAC", "Score");
+
+	for (off = 0; off + E_MACADDR_47_32 + 2 <= st.st_size; off += stride) {
+		chip = chip_find(loc_read_word(img, off + E_CHIPID));
+		if (!chip)
+			continue;
+		score = loc_score(img + off, st.st_size - off);
+		if (score < score_min)
+			continue;
+
+		mc->eep_len = E_MACADDR_47_32 + 2;
+		memcpy(mc->eep_buf, img + off, mc->eep_len);
+		printf("0x%08zx  %-8s  %3u.%-3u  %-17s  %d/%d\n", off,
+		       chip->name, img[off + E_VERSION + 1],
+		       img[off + E_VERSION], get_macaddr_str(mc), score,
+		       LOC_SCORE_MAX);
+		nhits++;
+	}
+
+	if (!nhits) {
+		printf("No EEPROM candidates found\n");
+		goto exit_unmap;
+	}
+
+	for (off = 0; off + E_MACADDR_47_32 + 2 <= st.st_size; off += stride) {
+		chip = chip_find(loc_read_word(img, off + E_CHIPID));
+		if (!chip || loc_score(img + off, st.st_size - off) < score_min)
+			continue;
+		loc_decode(mc, chip, img + off, off, st.st_size - off);
+	}
+
+exit_unmap:
+	munmap((void *)img, st.st_size);
+
+exit_close:
+	close(fd);
+
+	return ret;
+}
@@ -0,0 +1,232 @@
+/**
+ * Metrics export in the Prometheus text format
+ *
+ * Copyright (c) 2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <time.h>
+
+#include <sys/stat.h>
+
+#include "mtkeepmgr.h"
+#include "utils.h"
+#include "field.h"
+#include "metrics.h"
+
+/* Calibration fields exported by default */
+#define METRICS_FIELDS_DEF	"freq_offset,temp_offset,xtal_opt,tgtpwr.*"
+
+/* Print a label value with the Prometheus escaping rules applied */
+static void metrics_label(FILE *fp, const char *str)
+{
+	for (; *str; ++str) {
+		if (*str == '\\' || *str == '"')
+			fprintf(fp, "\\%c", *str);
+		else if (*str == '\n')
+			fprintf(fp, "\\n");
+		else
+			fputc(*str, fp);
+	}
+}
+
+/* Microseconds to seconds conversion without the floating point */
+static const char *metrics_sec(char *buf, size_t bufsz, uint64_t us)
+{
+	snprintf(buf, bufsz, "%llu.%06llu", (unsigned long long)us / 1000000,
+		 (unsigned long long)us % 1000000);
+
+	return buf;
+}
+
+static int metrics_field_match(const struct eep_field *f, const char *patterns)
+{
+	char pat[0x40];
+	const char *p, *e;
+
+	for (p = patterns; *p; p = *e ? e + 1 : e) {
+		e = strchr(p, ',') ? : p + strlen(p);
+		snprintf(pat, sizeof(pat), "%.*s", (int)(e - p), p);
+		if (fnmatch(pat, f->name, 0) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+#define M_HDR(__fp, __name, __type, __help)				\
+	fprintf(__fp, "# HELP mtkeepmgr_" __name " " __help "\n"	\
+		      "# TYPE mtkeepmgr_" __name " " __type "\n")
+
+/* Start a metric sample with the device path label */
+#define M_DEV(__fp, __mc, __name)					\
+	do {								\
+		fprintf(__fp, "mtkeepmgr_" __name "{path=\"");		\
+		metrics_label(__fp, (__mc)->dev_path);			\
+		fprintf(__fp, "\"");					\
+	} while (0)
+
+static void metrics_xfers(FILE *fp, struct main_ctx *mc)
+{
+	const struct con_stats *cs = &mc->cs;
+	unsigned i, cnt = 0;
+	char buf[0x20];
+
+	M_HDR(fp, "xfer_latency_seconds", "histogram",
+	      "EEPROM data transfer latency");
+	for (i = 0; i < CON_LAT_NBUCKETS; ++i) {
+		cnt += cs->lat_hist[i];
+		M_DEV(fp, mc, "xfer_latency_seconds_bucket");
+		fprintf(fp, ",le=\"%s\"} %u\n",
+			metrics_sec(buf, sizeof(buf), con_lat_buckets[i]),
+			cnt);
+	}
+	M_DEV(fp, mc, "xfer_latency_seconds_bucket");
+	fprintf(fp, ",le=\"+Inf\"} %u\n", cs->nxfers);
+	M_DEV(fp, mc, "xfer_latency_seconds_sum");
+	fprintf(fp, "} %s\n", metrics_sec(buf, sizeof(buf), cs->lat_sum));
+	M_DEV(fp, mc, "xfer_latency_seconds_count");
+	fprintf(fp, "} %u\n", cs->nxfers);
+
+	M_HDR(fp, "xfer_retries_total", "counter",
+	      "Retried EEPROM data transfers");
+	M_DEV(fp, mc, "xfer_retries_total");
+	fprintf(fp, "} %u\n", cs->nretries);
+	M_HDR(fp, "xfer_timeouts_total", "counter",
+	      "Timed out EEPROM data transfers");
+	M_DEV(fp, mc, "xfer_timeouts_total");
+	fprintf(fp, "} %u\n", cs->ntimeouts);
+	M_HDR(fp, "xfer_short_reads_total", "counter",
+	      "Short EEPROM data reads");
+	M_DEV(fp, mc, "xfer_short_reads_total");
+	fprintf(fp, "} %u\n", cs->nshort);
+	M_HDR(fp, "device_resets_total", "counter",
+	      "Device resets due to transfer failures");
+	M_DEV(fp, mc, "device_resets_total");
+	fprintf(fp, "} %u\n", cs->nresets);
+}
+
+/* Export only already fetched fields to not cause extra device access */
+static void metrics_fields(FILE *fp, struct main_ctx *mc,
+			   const struct chip_desc *chip)
+{
+	const char *patterns = mc->metrics_fields ? : METRICS_FIELDS_DEF;
+	const struct eep_field *f;
+	char buf[0x20];
+	int val;
+
+	M_HDR(fp, "eeprom_field", "gauge",
+	      "EEPROM calibration field value");
+	for_each_field(chip, f) {
+		if (f->flags & EEP_FF_MACADDR ||
+		    !metrics_field_match(f, patterns) ||
+		    !eep_is_loaded(mc, f->off, field_size(f)))
+			continue;
+		val = field_value(mc, f);
+		M_DEV(fp, mc, "eeprom_field");
+		fprintf(fp, ",field=\"%s\"} ", f->name);
+		if (f->flags & EEP_FF_HALF)
+			fprintf(fp, "%s\n", half_str(buf, sizeof(buf), val, 0));
+		else
+			fprintf(fp, "%d\n", val);
+	}
+}
+
+static void metrics_print(FILE *fp, struct main_ctx *mc, int status)
+{
+	const struct chip_desc *chip = NULL;
+
+	if (mc->eep_len && eep_is_loaded(mc, E_CHIPID, 2))
+		chip = chip_find(eep_read_word(mc, E_CHIPID));
+
+	M_HDR(fp, "device_info", "gauge", "Processed device");
+	M_DEV(fp, mc, "device_info");
+	fprintf(fp, ",connector=\"%s\",model=\"%s\",chip=\"%s\"} 1\n",
+		mc->con ? mc->con->name : "", mc->dev_model,
+		chip ? chip->name : "");
+
+	if (mc->dev_model[0]) {
+		M_HDR(fp, "devices_seen", "gauge", "Devices per model");
+		fprintf(fp, "mtkeepmgr_devices_seen{model=\"%s\"} 1\n",
+			mc->dev_model);
+	}
+
+	M_HDR(fp, "unknown_chipid_total", "counter",
+	      "EEPROM data of unknown chips");
+	fprintf(fp, "mtkeepmgr_unknown_chipid_total %u\n", mc->nunknown);
+
+	metrics_xfers(fp, mc);
+	if (chip)
+		metrics_fields(fp, mc, chip);
+
+	M_HDR(fp, "last_run_success", "gauge",
+	      "Whether the last run was successful");
+	fprintf(fp, "mtkeepmgr_last_run_success %d\n", !status);
+	M_HDR(fp, "last_run_timestamp_seconds", "gauge",
+	      "Time of the last run");
+	fprintf(fp, "mtkeepmgr_last_run_timestamp_seconds %llu\n",
+		(unsigned long long)time(NULL));
+}
+
+/**
+ * Write metrics to a temporary file and then rename it to the target name,
+ * so a collector (e.g. the node_exporter textfile collector) never observes
+ * a partially written file.
+ */
+int metrics_write(struct main_ctx *mc, int status)
+{
+	char tmpname[0x100];
+	FILE *fp;
+	int fd, res;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.XXXXXX", mc->metrics_file);
+	fd = mkstemp(tmpname);
+	if (fd == -1) {
+		res = errno;
+		fprintf(stderr, "metrics: unable to create '%s': %s\n", tmpname,
+			strerror(res));
+		return -res;
+	}
+	fchmod(fd, 0644);
+
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		res = -errno;
+		close(fd);
+		goto err;
+	}
+
+	metrics_print(fp, mc, status);
+
+	res = fflush(fp) || fsync(fd) ? -errno : 0;
+	if (fclose(fp) && !res)
+		res = -errno;
+	if (!res && rename(tmpname, mc->metrics_file))
+		res = -errno;
+	if (!res)
+		return 0;
+
+err:
+	fprintf(stderr, "metrics: unable to write '%s': %s\n",
+		mc->metrics_file, strerror(-res));
+	unlink(tmpname);
+
+	return res;
+}
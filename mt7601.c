@@ -31,4 +31,16 @@ static int mt7601_eep_parse(struct main_ctx *mc)
 	return 0;
 }
 
-CHIP(MT7601, 0x7601, mt7601_eep_parse);
+static const struct eep_field mt7601_fields[] = {
+	EEP_FIELDS_COMMON,
+	{}
+};
+
+/* EEPROM ranges accessed by the parser */
+static const struct eep_range mt7601_plan[] = {
+	{E_CHIPID, E_MACADDR_47_32 + 2},
+	{}
+};
+
+CHIP(MT7601, 0x7601, mt7601_eep_parse, .plan = mt7601_plan,
+     .fields = mt7601_fields);
@@ -17,6 +17,8 @@
  */
 
 #include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "mtkeepmgr.h"
@@ -26,55 +28,70 @@
 /* Preserved values for further calculations */
 static int8_t temp_offset;		/* Temperature offset */
 
+/* Return channel power in 0.5 dBm step */
+static int pwr_chan_decode(unsigned val)
+{
+	if (E_CH_PWR_MIN <= val && val <= E_CH_PWR_MAX)
+		return val;
+
+	return E_CH_PWR_DEFAULT;
+}
+
 static const char *pwr_chan_str(const uint8_t val)
 {
 	static char buf[0x10];
-	unsigned __val;
-
-	if (E_CH_PWR_MIN <= val && val <= E_CH_PWR_MAX)
-		__val = val;
-	else
-		__val = E_CH_PWR_DEFAULT;
+	unsigned __val = pwr_chan_decode(val);
 
 	/* Value is in 0.5 dBm and non-negative */
-	snprintf(buf, sizeof(buf), "%.1f", (double)__val / 2);
-
-	return buf;
+	return half_str(buf, sizeof(buf), __val, 0);
+}
 
+/* Return target power in 0.5 dBm step */
+static int pwr_target_decode(unsigned val)
+{
+	return 0x00 == val || 0xff == val ? 32 : val;
 }
 
 static const char *pwr_target_str(const uint8_t val)
 {
 	static char buf[0x20];
-	char str[0x12];
+	char str[0x12], hbuf[0x8];
 
 	if (0x00 == val || 0xff == val)
 		snprintf(str, sizeof(str), "16.0 dBm, default");
 	else
-		snprintf(str, sizeof(str), "%.1f dBm", (double)val / 2);
+		snprintf(str, sizeof(str), "%s dBm",
+			 half_str(hbuf, sizeof(hbuf), val, 0));
 
 	snprintf(buf, sizeof(buf), "%02Xh (%s)", val, str);
 
 	return buf;
 }
 
+/* Return power delta in 0.5 dBm step */
+static int pwr_delta_decode(unsigned val)
+{
+	if (0xff == val || !(val & E_PWR_DELTA_EN))
+		return 0;
+
+	return val & E_PWR_DELTA_SIGN ? FIELD_GET(E_PWR_DELTA_VAL, val) :
+					-1 * FIELD_GET(E_PWR_DELTA_VAL, val);
+}
+
 /* Return decoded power delta */
 static const char *pwr_delta_str(const uint8_t val)
 {
 	static char buf[0x20];
-	char str[0x12];
-	int delta;
+	char str[0x12], hbuf[0x8];
+	int delta = pwr_delta_decode(val);
 
-	if (0xff == val) {
+	if (0xff == val)
 		snprintf(str, sizeof(str), "0.0 dBm, default");
-	} else if (!(val & E_PWR_DELTA_EN)) {
+	else if (!(val & E_PWR_DELTA_EN))
 		snprintf(str, sizeof(str), "0.0 dBm, disabled");
-	} else {
-		delta = val & E_PWR_DELTA_SIGN ?
-			FIELD_GET(E_PWR_DELTA_VAL, val):
-			-1 * FIELD_GET(E_PWR_DELTA_VAL, val);
-		snprintf(str, sizeof(str), "%+.1f dBm", (double)delta / 2);
-	}
+	else
+		snprintf(str, sizeof(str), "%s dBm",
+			 half_str(hbuf, sizeof(hbuf), delta, HALF_F_PLUS));
 
 	snprintf(buf, sizeof(buf), "%02Xh (%s)", val, str);
 
@@ -93,9 +110,7 @@ static const char *pwr_rate_str(const uint8_t val)
 	static char buf[0x10];
 	int pwr = pwr_rate_unpack(val);
 
-	snprintf(buf, sizeof(buf), "%.1f", (double)pwr / 2);
-
-	return buf;
+	return half_str(buf, sizeof(buf), pwr, 0);
 }
 
 static const char *country_str(const uint8_t val)
@@ -143,51 +158,58 @@ static const char *rssi_offset_str(const uint8_t val)
 	return buf;
 }
 
+static const unsigned ch_2gh[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
+				  14};
+static const unsigned ch_5gh_0[] = {36, 38, 40, 44, 46, 48, 52, 54, 56, 60, 62,
+				    64};
+static const unsigned ch_5gh_1[] = {100, 102, 104, 108, 110, 112, 116, 118,
+				    120, 124, 126, 128, 132, 134, 136, 140};
+static const unsigned ch_5gh_2[] = {149, 151, 153, 157, 159, 161, 165, 167,
+				    169, 171, 173};
+
+static const struct mt7610_subband {
+	const char *name;	/* Subband name */
+	unsigned band;		/* 2 - 2.4 GHz, 5 - 5 GHz */
+	unsigned ee_base;	/* EEPROM base offset */
+	unsigned const *ch;	/* Channels array */
+	unsigned nchan;		/* Number of channels */
+} mt7610_subbands[] = {
+	{
+		.name = "2.4 GHz",
+		.band = 2,
+		.ee_base = E_CH_PWR_2G_BASE,
+		.ch = ch_2gh,
+		.nchan = ARRAY_SIZE(ch_2gh),
+	}, {
+		.name = "5 GHz (low)",
+		.band = 5,
+		.ee_base = E_CH_PWR_5G_0_BASE,
+		.ch = ch_5gh_0,
+		.nchan = ARRAY_SIZE(ch_5gh_0),
+	}, {
+		.name = "5 GHz (middle)",
+		.band = 5,
+		.ee_base = E_CH_PWR_5G_1_BASE,
+		.ch = ch_5gh_1,
+		.nchan = ARRAY_SIZE(ch_5gh_1),
+	}, {
+		.name = "5 GHz (hight)",
+		.band = 5,
+		.ee_base = E_CH_PWR_5G_2_BASE,
+		.ch = ch_5gh_2,
+		.nchan = ARRAY_SIZE(ch_5gh_2),
+	}
+};
+
 static void mt7610_dump_channel_power(struct main_ctx *mc)
 {
-	static const unsigned ch_2gh[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
-					  12, 13, 14};
-	static const unsigned ch_5gh_0[] = {36, 38, 40, 44, 46, 48, 52, 54, 56,
-					    60, 62, 64};
-	static const unsigned ch_5gh_1[] = {100, 102, 104, 108, 110, 112, 116,
-					    118, 120, 124, 126, 128, 132, 134,
-					    136, 140};
-	static const unsigned ch_5gh_2[] = {149, 151, 153, 157, 159, 161, 165,
-					    167, 169, 171, 173};
-	static const struct {
-		const char *name;	/* Subband name */
-		unsigned ee_base;	/* EEPROM base offset */
-		unsigned const *ch;	/* Channels array */
-		unsigned nchan;		/* Number of channels */
-	} *sb, subbands[] = {
-		{
-			.name = "2.4 GHz",
-			.ee_base = E_CH_PWR_2G_BASE,
-			.ch = ch_2gh,
-			.nchan = ARRAY_SIZE(ch_2gh),
-		}, {
-			.name = "5 GHz (low)",
-			.ee_base = E_CH_PWR_5G_0_BASE,
-			.ch = ch_5gh_0,
-			.nchan = ARRAY_SIZE(ch_5gh_0),
-		}, {
-			.name = "5 GHz (middle)",
-			.ee_base = E_CH_PWR_5G_1_BASE,
-			.ch = ch_5gh_1,
-			.nchan = ARRAY_SIZE(ch_5gh_1),
-		}, {
-			.name = "5 GHz (hight)",
-			.ee_base = E_CH_PWR_5G_2_BASE,
-			.ch = ch_5gh_2,
-			.nchan = ARRAY_SIZE(ch_5gh_2),
-		}
-	};
+	const struct mt7610_subband *sb;
 	unsigned pwr[0x10];	/* size = MAX(2G, 5G0, 5G1, 5G2) */
 	unsigned si, ci;
 	uint16_t eeval;
 
-	for (si = 0; si < ARRAY_SIZE(subbands); ++si) {
-		sb = &subbands[si];
+	for (si = 0; si < ARRAY_SIZE(mt7610_subbands); ++si) {
+		sb = &mt7610_subbands[si];
 		printf("  Subband: %s\n", sb->name);
 		for (ci = 0; ci < sb->nchan; ci += 2) {
 			eeval = eep_read_word(mc, sb->ee_base + ci);
@@ -351,6 +373,7 @@ static int mt7610_eep_parse(struct main_ctx *mc)
 		[E_ANT_DIV_FIX_MAIN] = "Fixed main antenna",
 		[E_ANT_DIV_FIX_AUX] = "Fixed aux antenna"
 	};
+	char hbuf[0x8];
 	uint16_t val;
 
 	printf("[Device identification]\n");
@@ -481,8 +504,9 @@ static int mt7610_eep_parse(struct main_ctx *mc)
 	if (FIELD_GET(E_TX_AGC_STEP_VAL, val) == 0xff)
 		printf("  Tx AGC step   : 1.0 dBm (default)\n");
 	else
-		printf("  Tx AGC step   : %.1f dBm\n",
-		       (double)FIELD_GET(E_TX_AGC_STEP_VAL, val) / 2);
+		printf("  Tx AGC step   : %s dBm\n",
+		       half_str(hbuf, sizeof(hbuf),
+				FIELD_GET(E_TX_AGC_STEP_VAL, val), 0));
 	val = eep_read_word(mc, E_TSSI_TCOMP_5G_BOUND);
 	printf("  5GHz boundary : %u (channel)\n",
 	       FIELD_GET(E_TSSI_TCOMP_5G_BOUND_VAL, val));
@@ -495,4 +519,513 @@ static int mt7610_eep_parse(struct main_ctx *mc)
 	return 0;
 }
 
-CHIP(MT7610, 0x7610, mt7610_eep_parse);
+/* Return Tx AGC step in 0.5 dBm step */
+static int tx_agc_step_decode(unsigned val)
+{
+	return val == 0xff ? 2 : val;
+}
+
+#define TXPWR_RATE_F_HT		0x01	/* 40 MHz capable */
+#define TXPWR_RATE_F_VHT	0x02	/* 80 MHz capable */
+
+static const struct mt7610_txpwr_rate {
+	const char *name;
+	unsigned off_2g;	/* Rate delta word in 2.4 GHz, 0 if n/a */
+	unsigned off_5g;	/* Rate delta word in 5 GHz, 0 if n/a */
+	uint16_t mask;
+	unsigned flags;
+} mt7610_txpwr_rates[] = {
+	{"CCK1", E_RATE_PWR_2G_CCK_1_55, 0, E_RATE_PWR_LO, 0},
+	{"CCK5", E_RATE_PWR_2G_CCK_1_55, 0, E_RATE_PWR_HI, 0},
+	{"OFDM6", E_RATE_PWR_2G_OFDM_6_12, E_RATE_PWR_5G_OFDM_6_12,
+	 E_RATE_PWR_LO, 0},
+	{"OFDM12", E_RATE_PWR_2G_OFDM_6_12, E_RATE_PWR_5G_OFDM_6_12,
+	 E_RATE_PWR_HI, 0},
+	{"OFDM24", E_RATE_PWR_2G_OFDM_24_48, E_RATE_PWR_5G_OFDM_24_48,
+	 E_RATE_PWR_LO, 0},
+	{"OFDM48", E_RATE_PWR_2G_OFDM_24_48, E_RATE_PWR_5G_OFDM_24_48,
+	 E_RATE_PWR_HI, 0},
+	{"MCS0", E_RATE_PWR_2G_MCS_0_2, E_RATE_PWR_5G_MCS_0_2, E_RATE_PWR_LO,
+	 TXPWR_RATE_F_HT | TXPWR_RATE_F_VHT},
+	{"MCS2", E_RATE_PWR_2G_MCS_0_2, E_RATE_PWR_5G_MCS_0_2, E_RATE_PWR_HI,
+	 TXPWR_RATE_F_HT | TXPWR_RATE_F_VHT},
+	{"MCS4", E_RATE_PWR_2G_MCS_4_6, E_RATE_PWR_5G_MCS_4_6, E_RATE_PWR_LO,
+	 TXPWR_RATE_F_HT | TXPWR_RATE_F_VHT},
+	{"MCS6", E_RATE_PWR_2G_MCS_4_6, E_RATE_PWR_5G_MCS_4_6, E_RATE_PWR_HI,
+	 TXPWR_RATE_F_HT | TXPWR_RATE_F_VHT},
+	{"MCS8", 0, E_RATE_PWR_5G_VHT_8_9, E_RATE_PWR_LO, TXPWR_RATE_F_VHT},
+};
+
+#define TXPWR_NRATES		ARRAY_SIZE(mt7610_txpwr_rates)
+
+/* Unpacked power data of a band, all values are in 0.5 dBm */
+struct mt7610_txpwr_band {
+	unsigned band;
+	unsigned nchan;
+	unsigned ch[ARRAY_SIZE(ch_5gh_0) + ARRAY_SIZE(ch_5gh_1) +
+		    ARRAY_SIZE(ch_5gh_2)];
+	int8_t chpwr[ARRAY_SIZE(ch_5gh_0) + ARRAY_SIZE(ch_5gh_1) +
+		     ARRAY_SIZE(ch_5gh_2)];
+	int8_t tcomp[ARRAY_SIZE(ch_5gh_0) + ARRAY_SIZE(ch_5gh_1) +
+		     ARRAY_SIZE(ch_5gh_2)];
+	int8_t rate[TXPWR_NRATES];	/* INT8_MIN if the rate is n/a */
+	int8_t bw_delta[3];		/* 20, 40 and 80 MHz */
+};
+
+/**
+ * Find the TSSI compensation step of the temperature. Hotter PA gives
+ * lower output power, so each passed upper boundary increases the power
+ * by one Tx AGC step and each passed lower boundary decreases it.
+ */
+static int mt7610_tcomp_step(const int8_t *tbl, int temp)
+{
+	const int mid = E_TSSI_TCOMP_N / 2;
+	int step;
+
+	for (step = 0; step < mid && temp > tbl[mid + step + 1]; ++step);
+	if (step)
+		return step;
+	for (; step > -mid && temp < tbl[mid + step - 1]; --step);
+
+	return step;
+}
+
+static void mt7610_txpwr_unpack(struct main_ctx *mc, unsigned band,
+				int temp, int use_temp,
+				struct mt7610_txpwr_band *b)
+{
+	int8_t tbl1[E_TSSI_TCOMP_N + 1], tbl2[E_TSSI_TCOMP_N + 1];
+	const struct mt7610_txpwr_rate *r;
+	const struct mt7610_subband *sb;
+	unsigned si, ci, off, bound;
+	int comp1 = 0, comp2 = 0, agc_step;
+	uint16_t val;
+
+	memset(b, 0, sizeof(*b));
+	b->band = band;
+
+	if (band == 5 && use_temp) {
+		val = eep_read_word(mc, E_TEMP_2G_TGT_PWR);
+		temp_offset = (int8_t)FIELD_GET(E_TEMP_VAL, val);
+		val = eep_read_word(mc, E_TX_AGC_STEP);
+		agc_step = tx_agc_step_decode(FIELD_GET(E_TX_AGC_STEP_VAL, val));
+		mt7610_read_tssi_tcomp_tbl(mc, E_TSSI_TCOMP_5G_1_BASE, tbl1);
+		mt7610_adj_tssi_tcomp_tbl(tbl1);
+		mt7610_read_tssi_tcomp_tbl(mc, E_TSSI_TCOMP_5G_2_BASE, tbl2);
+		mt7610_adj_tssi_tcomp_tbl(tbl2);
+		comp1 = mt7610_tcomp_step(tbl1, temp) * agc_step;
+		comp2 = mt7610_tcomp_step(tbl2, temp) * agc_step;
+	}
+	val = eep_read_word(mc, E_TSSI_TCOMP_5G_BOUND);
+	bound = FIELD_GET(E_TSSI_TCOMP_5G_BOUND_VAL, val);
+
+	for (si = 0; si < ARRAY_SIZE(mt7610_subbands); ++si) {
+		sb = &mt7610_subbands[si];
+		if (sb->band != band)
+			continue;
+		for (ci = 0; ci < sb->nchan; ++ci, ++b->nchan) {
+			val = eep_read_word(mc, sb->ee_base + (ci & ~1));
+			b->ch[b->nchan] = sb->ch[ci];
+			b->chpwr[b->nchan] = pwr_chan_decode(ci & 1 ?
+						FIELD_GET(E_CH_PWR_HI, val) :
+						FIELD_GET(E_CH_PWR_LO, val));
+			b->tcomp[b->nchan] = sb->ch[ci] < bound ? comp1 : comp2;
+		}
+	}
+
+	for (r = mt7610_txpwr_rates; r < &mt7610_txpwr_rates[TXPWR_NRATES]; ++r) {
+		off = band == 2 ? r->off_2g : r->off_5g;
+		if (!off) {
+			b->rate[r - mt7610_txpwr_rates] = INT8_MIN;
+			continue;
+		}
+		val = eep_read_word(mc, off);
+		b->rate[r - mt7610_txpwr_rates] = pwr_rate_unpack(r->mask ==
+						E_RATE_PWR_HI ?
+						FIELD_GET(E_RATE_PWR_HI, val) :
+						FIELD_GET(E_RATE_PWR_LO, val));
+	}
+
+	val = eep_read_word(mc, E_40M_PWR_DELTA);
+	b->bw_delta[1] = pwr_delta_decode(band == 2 ?
+					  FIELD_GET(E_40M_PWR_DELTA_2G, val) :
+					  FIELD_GET(E_40M_PWR_DELTA_5G, val));
+	val = eep_read_word(mc, E_PWR_5G_80M_TGT);
+	b->bw_delta[2] = band == 2 ? INT8_MIN :
+			 pwr_delta_decode(FIELD_GET(E_PWR_5G_80M_DELTA, val));
+}
+
+/* Is the rate applicable to the bandwidth (0 - 20, 1 - 40, 2 - 80 MHz) */
+static int mt7610_txpwr_valid(const struct mt7610_txpwr_band *b, unsigned ri,
+			      unsigned bwi)
+{
+	unsigned flags = mt7610_txpwr_rates[ri].flags;
+
+	if (b->rate[ri] == INT8_MIN || b->bw_delta[bwi] == INT8_MIN)
+		return 0;
+	if (bwi == 1)
+		return !!(flags & TXPWR_RATE_F_HT);
+	if (bwi == 2)
+		return !!(flags & TXPWR_RATE_F_VHT);
+
+	return 1;
+}
+
+/**
+ * Compute the power of all channels for one rate and bandwidth. Plain
+ * integer loop over the unpacked arrays, which the compiler vectorizes.
+ */
+static void mt7610_txpwr_calc(const struct mt7610_txpwr_band *b, unsigned ri,
+			      unsigned bwi, int8_t *out)
+{
+	int add = b->rate[ri] + b->bw_delta[bwi];
+	unsigned ci;
+	int v;
+
+	for (ci = 0; ci < b->nchan; ++ci) {
+		v = b->chpwr[ci] + b->tcomp[ci] + add;
+		out[ci] = v < 0 ? 0 : v > E_CH_PWR_MAX ? E_CH_PWR_MAX : v;
+	}
+}
+
+static const unsigned mt7610_txpwr_bw[3] = {20, 40, 80};
+
+static void mt7610_txpwr_table(const struct mt7610_txpwr_band *b)
+{
+	int8_t out[TXPWR_NRATES][ARRAY_SIZE(b->ch)];
+	unsigned bwi, ri, ci;
+	char hbuf[0x8];
+
+	for (bwi = 0; bwi < ARRAY_SIZE(mt7610_txpwr_bw); ++bwi) {
+		for (ri = 0; ri < TXPWR_NRATES; ++ri)
+			if (mt7610_txpwr_valid(b, ri, bwi))
+				break;
+		if (ri == TXPWR_NRATES)
+			continue;
+
+		printf("[%s GHz, %u MHz, dBm]\n", b->band == 2 ? "2.4" : "5",
+		       mt7610_txpwr_bw[bwi]);
+		printf("  Channel");
+		for (ri = 0; ri < TXPWR_NRATES; ++ri) {
+			if (!mt7610_txpwr_valid(b, ri, bwi))
+				continue;
+			printf(" %6s", mt7610_txpwr_rates[ri].name);
+			mt7610_txpwr_calc(b, ri, bwi, out[ri]);
+		}
+		printf("\n");
+		for (ci = 0; ci < b->nchan; ++ci) {
+			printf("  %7u", b->ch[ci]);
+			for (ri = 0; ri < TXPWR_NRATES; ++ri)
+				if (mt7610_txpwr_valid(b, ri, bwi))
+					printf(" %6s", half_str(hbuf,
+							sizeof(hbuf),
+							out[ri][ci], 0));
+			printf("\n");
+		}
+		printf("\n");
+	}
+}
+
+static void mt7610_txpwr_csv(struct main_ctx *mc,
+			     const struct mt7610_txpwr_band *b)
+{
+	int8_t out[ARRAY_SIZE(b->ch)];
+	const char *macaddr = get_macaddr_str(mc);
+	unsigned bwi, ri, ci;
+	char hbuf[0x8];
+
+	for (bwi = 0; bwi < ARRAY_SIZE(mt7610_txpwr_bw); ++bwi) {
+		for (ri = 0; ri < TXPWR_NRATES; ++ri) {
+			if (!mt7610_txpwr_valid(b, ri, bwi))
+				continue;
+			mt7610_txpwr_calc(b, ri, bwi, out);
+			for (ci = 0; ci < b->nchan; ++ci)
+				printf("%s,%u,%u,%u,%s,%s\n", macaddr,
+				       b->band, b->ch[ci], mt7610_txpwr_bw[bwi],
+				       mt7610_txpwr_rates[ri].name,
+				       half_str(hbuf, sizeof(hbuf), out[ci],
+						0));
+		}
+	}
+}
+
+static int mt7610_txpower_iter(struct main_ctx *mc,
+			       void (*cb)(const struct txpwr_point *pt,
+					  void *priv),
+			       void *priv)
+{
+	int8_t out[ARRAY_SIZE(((struct mt7610_txpwr_band *)0)->ch)];
+	struct mt7610_txpwr_band b;
+	struct txpwr_point pt;
+	unsigned bwi, ri, ci;
+
+	for (pt.band = 2; pt.band <= 5; pt.band += 3) {
+		mt7610_txpwr_unpack(mc, pt.band, 0, 0, &b);
+		for (bwi = 0; bwi < ARRAY_SIZE(mt7610_txpwr_bw); ++bwi) {
+			pt.bw = mt7610_txpwr_bw[bwi];
+			for (ri = 0; ri < TXPWR_NRATES; ++ri) {
+				if (!mt7610_txpwr_valid(&b, ri, bwi))
+					continue;
+				pt.rate = mt7610_txpwr_rates[ri].name;
+				mt7610_txpwr_calc(&b, ri, bwi, out);
+				for (ci = 0; ci < b.nchan; ++ci) {
+					pt.chan = b.ch[ci];
+					pt.pwr = out[ci];
+					cb(&pt, priv);
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Compute effective Tx power of each channel, rate group and bandwidth:
+ * channel power + rate delta + bandwidth delta, and optionally the TSSI
+ * temperature compensation for the specified temperature sensor reading.
+ *
+ * Arguments: [table|csv [<temp>]]
+ */
+static int mt7610_txpower(struct main_ctx *mc, int argc, char *argv[])
+{
+	struct mt7610_txpwr_band b;
+	int csv = 0, temp = 0, use_temp = 0;
+	unsigned band;
+	char *endp;
+
+	if (argc >= 1) {
+		if (strcmp(argv[0], "csv") == 0) {
+			csv = 1;
+		} else if (strcmp(argv[0], "table") != 0) {
+			fprintf(stderr, "Unknown output format -- %s\n", argv[0]);
+			return -EINVAL;
+		}
+	}
+	if (argc >= 2) {
+		temp = strtol(argv[1], &endp, 0);
+		if (*endp != '\0') {
+			fprintf(stderr, "Invalid temperature -- %s\n", argv[1]);
+			return -EINVAL;
+		}
+		use_temp = 1;
+	}
+
+	if (csv)
+		printf("macaddr,band,channel,bw,rate,power\n");
+
+	for (band = 2; band <= 5; band += 3) {
+		mt7610_txpwr_unpack(mc, band, temp, use_temp, &b);
+		if (csv)
+			mt7610_txpwr_csv(mc, &b);
+		else
+			mt7610_txpwr_table(&b);
+	}
+
+	return 0;
+}
+
+#define CH_PWR_FIELD(__band, __ch, __base, __idx)			\
+	EEP_FIELD("txpwr." __band ".ch" #__ch, (__base) + ((__idx) & ~1),\
+		  (__idx) & 1 ? E_CH_PWR_HI : E_CH_PWR_LO,		\
+		  .flags = EEP_FF_HALF, .decode = pwr_chan_decode)
+
+#define RATE_PWR_LO	((E_RATE_PWR_VAL | E_RATE_PWR_SIGN) << E_RATE_PWR_LO_S)
+#define RATE_PWR_HI	((E_RATE_PWR_VAL | E_RATE_PWR_SIGN) << E_RATE_PWR_HI_S)
+#define RATE_PWR_FIELD(__name, __off, __mask)				\
+	EEP_FIELD("ratepwr." __name, __off, __mask,			\
+		  .flags = EEP_FF_HALF | EEP_FF_SIGNED)
+
+/* Each table word keeps the even point in the high byte */
+#define TSSI_FIELD(__grp, __n, __base)					\
+	EEP_FIELD("tssi." __grp "." #__n, (__base) + ((__n) & ~1),	\
+		  (__n) & 1 ? 0x00ff : 0xff00, .flags = EEP_FF_SIGNED)
+
+static const struct eep_field mt7610_fields[] = {
+	EEP_FIELDS_COMMON,
+	EEP_FIELD("pci.dev_id", E_PCI_DEV_ID, 0xffff, .flags = EEP_FF_HEX),
+	EEP_FIELD("pci.ven_id", E_PCI_VEN_ID, 0xffff, .flags = EEP_FF_HEX),
+	EEP_FIELD("pci.sub_dev_id", E_PCI_SUB_DEV_ID, 0xffff, .flags = EEP_FF_HEX),
+	EEP_FIELD("pci.sub_ven_id", E_PCI_SUB_VEN_ID, 0xffff, .flags = EEP_FF_HEX),
+	EEP_FIELD("usb.vid", E_USB_VID, 0xffff, .flags = EEP_FF_HEX),
+	EEP_FIELD("usb.pid", E_USB_PID, 0xffff, .flags = EEP_FF_HEX),
+	EEP_FIELD("cmb_aux_opt", E_CMB_AUX_OPT, 0xffff, .flags = EEP_FF_HEX),
+	EEP_FIELD("xtal_opt", E_XTAL_OPT, 0xffff, .flags = EEP_FF_HEX),
+	EEP_FIELD("nic.cfg0.rx_path", E_NIC_CFG0, E_NIC_CFG0_RX_PATH),
+	EEP_FIELD("nic.cfg0.tx_path", E_NIC_CFG0, E_NIC_CFG0_TX_PATH),
+	EEP_FIELD("nic.cfg0.int_2g_pa", E_NIC_CFG0, E_NIC_CFG0_INT_2G_PA),
+	EEP_FIELD("nic.cfg0.int_5g_pa", E_NIC_CFG0, E_NIC_CFG0_INT_5G_PA),
+	EEP_FIELD("nic.cfg0.ext_pa_curr", E_NIC_CFG0, E_NIC_CFG0_EXT_PA_CURR),
+	EEP_FIELD("nic.cfg1.hw_rf_ctrl", E_NIC_CFG1, E_NIC_CFG1_HW_RF_CTRL),
+	EEP_FIELD("nic.cfg1.ext_tx_alc", E_NIC_CFG1, E_NIC_CFG1_EXT_TX_ALC),
+	EEP_FIELD("nic.cfg1.ext_2g_lna", E_NIC_CFG1, E_NIC_CFG1_EXT_2G_LNA),
+	EEP_FIELD("nic.cfg1.ext_5g_lna", E_NIC_CFG1, E_NIC_CFG1_EXT_5G_LNA),
+	EEP_FIELD("nic.cfg1.cb_accel_dis", E_NIC_CFG1, E_NIC_CFG1_CB_ACCEL_DIS),
+	EEP_FIELD("nic.cfg1.40m_2g_sb", E_NIC_CFG1, E_NIC_CFG1_40M_2G_SB),
+	EEP_FIELD("nic.cfg1.40m_5g_sb", E_NIC_CFG1, E_NIC_CFG1_40M_5G_SB),
+	EEP_FIELD("nic.cfg1.wps_but_en", E_NIC_CFG1, E_NIC_CFG1_WPS_BUT_EN),
+	EEP_FIELD("nic.cfg1.40m_2g_dis", E_NIC_CFG1, E_NIC_CFG1_40M_2G_DIS),
+	EEP_FIELD("nic.cfg1.40m_5g_dis", E_NIC_CFG1, E_NIC_CFG1_40M_5G_DIS),
+	EEP_FIELD("nic.cfg1.ant_div", E_NIC_CFG1, E_NIC_CFG1_ANT_DIV),
+	EEP_FIELD("nic.cfg1.int_tx_alc", E_NIC_CFG1, E_NIC_CFG1_INT_TX_ALC),
+	EEP_FIELD("nic.cfg1.coex", E_NIC_CFG1, E_NIC_CFG1_COEX),
+	EEP_FIELD("nic.cfg1.dac_test", E_NIC_CFG1, E_NIC_CFG1_DAC_TEST),
+	EEP_FIELD("nic.cfg2.rx_stream", E_NIC_CFG2, E_NIC_CFG2_RX_STREAM),
+	EEP_FIELD("nic.cfg2.tx_stream", E_NIC_CFG2, E_NIC_CFG2_TX_STREAM),
+	EEP_FIELD("nic.cfg2.coex_ant", E_NIC_CFG2, E_NIC_CFG2_COEX_ANT),
+	EEP_FIELD("nic.cfg2.xtal_opt", E_NIC_CFG2, E_NIC_CFG2_XTAL_OPT),
+	EEP_FIELD("nic.cfg2.rxtemp_c_dis", E_NIC_CFG2, E_NIC_CFG2_RXTEMP_C_DIS),
+	EEP_FIELD("nic.cfg2.cal_in_flash", E_NIC_CFG2, E_NIC_CFG2_CAL_IN_FLASH),
+	EEP_FIELD("freq_offset", E_FREQ_OFFSET, E_FREQ_OFFSET_FO),
+	EEP_FIELD("temp_offset", E_TEMP_2G_TGT_PWR, E_TEMP_VAL,
+		  .flags = EEP_FF_SIGNED),
+	EEP_FIELD("country.2g", E_COUNTRY_REGION, E_COUNTRY_REGION_2G,
+		  .flags = EEP_FF_HEX),
+	EEP_FIELD("country.5g", E_COUNTRY_REGION, E_COUNTRY_REGION_5G,
+		  .flags = EEP_FF_HEX),
+	EEP_FIELD("lna.2g", E_LNA_GAIN_0, E_LNA_GAIN_2G),
+	EEP_FIELD("lna.5g_0", E_LNA_GAIN_0, E_LNA_GAIN_5G_0),
+	EEP_FIELD("lna.5g_1", E_LNA_GAIN_1, E_LNA_GAIN_5G_1),
+	EEP_FIELD("lna.5g_2", E_LNA_GAIN_2, E_LNA_GAIN_5G_2),
+	EEP_FIELD("lna.5g_mid_ch", E_LNA_5G_SUBBANDS, E_LNA_5G_SUBBANDS_MID_CH),
+	EEP_FIELD("lna.5g_high_ch", E_LNA_5G_SUBBANDS, E_LNA_5G_SUBBANDS_HIG_CH),
+	EEP_FIELD("rssi.2g_0", E_RSSI_OFFSET_2G, E_RSSI_OFFSET_2G_0,
+		  .flags = EEP_FF_SIGNED),
+	EEP_FIELD("rssi.2g_1", E_RSSI_OFFSET_2G, E_RSSI_OFFSET_2G_1,
+		  .flags = EEP_FF_SIGNED),
+	EEP_FIELD("rssi.5g_0", E_RSSI_OFFSET_5G, E_RSSI_OFFSET_5G_0,
+		  .flags = EEP_FF_SIGNED),
+	EEP_FIELD("rssi.5g_1", E_RSSI_OFFSET_5G, E_RSSI_OFFSET_5G_1,
+		  .flags = EEP_FF_SIGNED),
+	EEP_FIELD("tgtpwr.2g", E_TEMP_2G_TGT_PWR, E_PWR_2G_TARGET,
+		  .flags = EEP_FF_HALF, .decode = pwr_target_decode),
+	EEP_FIELD("tgtpwr.5g", E_PWR_5G_80M_TGT, E_PWR_5G_TARGET,
+		  .flags = EEP_FF_HALF, .decode = pwr_target_decode),
+	EEP_FIELD("pwrdelta.2g_40m", E_40M_PWR_DELTA, E_40M_PWR_DELTA_2G,
+		  .flags = EEP_FF_HALF, .decode = pwr_delta_decode),
+	EEP_FIELD("pwrdelta.5g_40m", E_40M_PWR_DELTA, E_40M_PWR_DELTA_5G,
+		  .flags = EEP_FF_HALF, .decode = pwr_delta_decode),
+	EEP_FIELD("pwrdelta.5g_80m", E_PWR_5G_80M_TGT, E_PWR_5G_80M_DELTA,
+		  .flags = EEP_FF_HALF, .decode = pwr_delta_decode),
+	CH_PWR_FIELD("2g", 1, E_CH_PWR_2G_BASE, 0),
+	CH_PWR_FIELD("2g", 2, E_CH_PWR_2G_BASE, 1),
+	CH_PWR_FIELD("2g", 3, E_CH_PWR_2G_BASE, 2),
+	CH_PWR_FIELD("2g", 4, E_CH_PWR_2G_BASE, 3),
+	CH_PWR_FIELD("2g", 5, E_CH_PWR_2G_BASE, 4),
+	CH_PWR_FIELD("2g", 6, E_CH_PWR_2G_BASE, 5),
+	CH_PWR_FIELD("2g", 7, E_CH_PWR_2G_BASE, 6),
+	CH_PWR_FIELD("2g", 8, E_CH_PWR_2G_BASE, 7),
+	CH_PWR_FIELD("2g", 9, E_CH_PWR_2G_BASE, 8),
+	CH_PWR_FIELD("2g", 10, E_CH_PWR_2G_BASE, 9),
+	CH_PWR_FIELD("2g", 11, E_CH_PWR_2G_BASE, 10),
+	CH_PWR_FIELD("2g", 12, E_CH_PWR_2G_BASE, 11),
+	CH_PWR_FIELD("2g", 13, E_CH_PWR_2G_BASE, 12),
+	CH_PWR_FIELD("2g", 14, E_CH_PWR_2G_BASE, 13),
+	CH_PWR_FIELD("5g", 36, E_CH_PWR_5G_0_BASE, 0),
+	CH_PWR_FIELD("5g", 38, E_CH_PWR_5G_0_BASE, 1),
+	CH_PWR_FIELD("5g", 40, E_CH_PWR_5G_0_BASE, 2),
+	CH_PWR_FIELD("5g", 44, E_CH_PWR_5G_0_BASE, 3),
+	CH_PWR_FIELD("5g", 46, E_CH_PWR_5G_0_BASE, 4),
+	CH_PWR_FIELD("5g", 48, E_CH_PWR_5G_0_BASE, 5),
+	CH_PWR_FIELD("5g", 52, E_CH_PWR_5G_0_BASE, 6),
+	CH_PWR_FIELD("5g", 54, E_CH_PWR_5G_0_BASE, 7),
+	CH_PWR_FIELD("5g", 56, E_CH_PWR_5G_0_BASE, 8),
+	CH_PWR_FIELD("5g", 60, E_CH_PWR_5G_0_BASE, 9),
+	CH_PWR_FIELD("5g", 62, E_CH_PWR_5G_0_BASE, 10),
+	CH_PWR_FIELD("5g", 64, E_CH_PWR_5G_0_BASE, 11),
+	CH_PWR_FIELD("5g", 100, E_CH_PWR_5G_1_BASE, 0),
+	CH_PWR_FIELD("5g", 102, E_CH_PWR_5G_1_BASE, 1),
+	CH_PWR_FIELD("5g", 104, E_CH_PWR_5G_1_BASE, 2),
+	CH_PWR_FIELD("5g", 108, E_CH_PWR_5G_1_BASE, 3),
+	CH_PWR_FIELD("5g", 110, E_CH_PWR_5G_1_BASE, 4),
+	CH_PWR_FIELD("5g", 112, E_CH_PWR_5G_1_BASE, 5),
+	CH_PWR_FIELD("5g", 116, E_CH_PWR_5G_1_BASE, 6),
+	CH_PWR_FIELD("5g", 118, E_CH_PWR_5G_1_BASE, 7),
+	CH_PWR_FIELD("5g", 120, E_CH_PWR_5G_1_BASE, 8),
+	CH_PWR_FIELD("5g", 124, E_CH_PWR_5G_1_BASE, 9),
+	CH_PWR_FIELD("5g", 126, E_CH_PWR_5G_1_BASE, 10),
+	CH_PWR_FIELD("5g", 128, E_CH_PWR_5G_1_BASE, 11),
+	CH_PWR_FIELD("5g", 132, E_CH_PWR_5G_1_BASE, 12),
+	CH_PWR_FIELD("5g", 134, E_CH_PWR_5G_1_BASE, 13),
+	CH_PWR_FIELD("5g", 136, E_CH_PWR_5G_1_BASE, 14),
+	CH_PWR_FIELD("5g", 140, E_CH_PWR_5G_1_BASE, 15),
+	CH_PWR_FIELD("5g", 149, E_CH_PWR_5G_2_BASE, 0),
+	CH_PWR_FIELD("5g", 151, E_CH_PWR_5G_2_BASE, 1),
+	CH_PWR_FIELD("5g", 153, E_CH_PWR_5G_2_BASE, 2),
+	CH_PWR_FIELD("5g", 157, E_CH_PWR_5G_2_BASE, 3),
+	CH_PWR_FIELD("5g", 159, E_CH_PWR_5G_2_BASE, 4),
+	CH_PWR_FIELD("5g", 161, E_CH_PWR_5G_2_BASE, 5),
+	CH_PWR_FIELD("5g", 165, E_CH_PWR_5G_2_BASE, 6),
+	CH_PWR_FIELD("5g", 167, E_CH_PWR_5G_2_BASE, 7),
+	CH_PWR_FIELD("5g", 169, E_CH_PWR_5G_2_BASE, 8),
+	CH_PWR_FIELD("5g", 171, E_CH_PWR_5G_2_BASE, 9),
+	CH_PWR_FIELD("5g", 173, E_CH_PWR_5G_2_BASE, 10),
+	RATE_PWR_FIELD("2g.cck1", E_RATE_PWR_2G_CCK_1_55, RATE_PWR_LO),
+	RATE_PWR_FIELD("2g.cck5", E_RATE_PWR_2G_CCK_1_55, RATE_PWR_HI),
+	RATE_PWR_FIELD("2g.ofdm6", E_RATE_PWR_2G_OFDM_6_12, RATE_PWR_LO),
+	RATE_PWR_FIELD("2g.ofdm12", E_RATE_PWR_2G_OFDM_6_12, RATE_PWR_HI),
+	RATE_PWR_FIELD("2g.ofdm24", E_RATE_PWR_2G_OFDM_24_48, RATE_PWR_LO),
+	RATE_PWR_FIELD("2g.ofdm48", E_RATE_PWR_2G_OFDM_24_48, RATE_PWR_HI),
+	RATE_PWR_FIELD("2g.mcs0", E_RATE_PWR_2G_MCS_0_2, RATE_PWR_LO),
+	RATE_PWR_FIELD("2g.mcs2", E_RATE_PWR_2G_MCS_0_2, RATE_PWR_HI),
+	RATE_PWR_FIELD("2g.mcs4", E_RATE_PWR_2G_MCS_4_6, RATE_PWR_LO),
+	RATE_PWR_FIELD("2g.mcs6", E_RATE_PWR_2G_MCS_4_6, RATE_PWR_HI),
+	RATE_PWR_FIELD("5g.ofdm6", E_RATE_PWR_5G_OFDM_6_12, RATE_PWR_LO),
+	RATE_PWR_FIELD("5g.ofdm12", E_RATE_PWR_5G_OFDM_6_12, RATE_PWR_HI),
+	RATE_PWR_FIELD("5g.ofdm24", E_RATE_PWR_5G_OFDM_24_48, RATE_PWR_LO),
+	RATE_PWR_FIELD("5g.ofdm48", E_RATE_PWR_5G_OFDM_24_48, RATE_PWR_HI),
+	RATE_PWR_FIELD("5g.mcs0", E_RATE_PWR_5G_MCS_0_2, RATE_PWR_LO),
+	RATE_PWR_FIELD("5g.mcs2", E_RATE_PWR_5G_MCS_0_2, RATE_PWR_HI),
+	RATE_PWR_FIELD("5g.mcs4", E_RATE_PWR_5G_MCS_4_6, RATE_PWR_LO),
+	RATE_PWR_FIELD("5g.mcs6", E_RATE_PWR_5G_MCS_4_6, RATE_PWR_HI),
+	RATE_PWR_FIELD("5g.vht8", E_RATE_PWR_5G_VHT_8_9, RATE_PWR_LO),
+	RATE_PWR_FIELD("stbc.mcs0", E_RATE_PWR_STBC_MCS_0_2, RATE_PWR_LO),
+	RATE_PWR_FIELD("stbc.mcs2", E_RATE_PWR_STBC_MCS_0_2, RATE_PWR_HI),
+	RATE_PWR_FIELD("stbc.mcs4", E_RATE_PWR_STBC_MCS_4_6, RATE_PWR_LO),
+	RATE_PWR_FIELD("stbc.mcs6", E_RATE_PWR_STBC_MCS_4_6, RATE_PWR_HI),
+	EEP_FIELD("tssi.agc_step", E_TX_AGC_STEP, E_TX_AGC_STEP_VAL,
+		  .flags = EEP_FF_HALF, .decode = tx_agc_step_decode),
+	EEP_FIELD("tssi.5g_bound", E_TSSI_TCOMP_5G_BOUND,
+		  E_TSSI_TCOMP_5G_BOUND_VAL),
+	TSSI_FIELD("5g_1", 0, E_TSSI_TCOMP_5G_1_BASE),
+	TSSI_FIELD("5g_1", 1, E_TSSI_TCOMP_5G_1_BASE),
+	TSSI_FIELD("5g_1", 2, E_TSSI_TCOMP_5G_1_BASE),
+	TSSI_FIELD("5g_1", 3, E_TSSI_TCOMP_5G_1_BASE),
+	TSSI_FIELD("5g_1", 4, E_TSSI_TCOMP_5G_1_BASE),
+	TSSI_FIELD("5g_1", 5, E_TSSI_TCOMP_5G_1_BASE),
+	TSSI_FIELD("5g_1", 6, E_TSSI_TCOMP_5G_1_BASE),
+	TSSI_FIELD("5g_1", 7, E_TSSI_TCOMP_5G_1_BASE),
+	TSSI_FIELD("5g_1", 8, E_TSSI_TCOMP_5G_1_BASE),
+	TSSI_FIELD("5g_1", 9, E_TSSI_TCOMP_5G_1_BASE),
+	TSSI_FIELD("5g_1", 10, E_TSSI_TCOMP_5G_1_BASE),
+	TSSI_FIELD("5g_1", 11, E_TSSI_TCOMP_5G_1_BASE),
+	TSSI_FIELD("5g_1", 12, E_TSSI_TCOMP_5G_1_BASE),
+	TSSI_FIELD("5g_1", 13, E_TSSI_TCOMP_5G_1_BASE),
+	TSSI_FIELD("5g_2", 0, E_TSSI_TCOMP_5G_2_BASE),
+	TSSI_FIELD("5g_2", 1, E_TSSI_TCOMP_5G_2_BASE),
+	TSSI_FIELD("5g_2", 2, E_TSSI_TCOMP_5G_2_BASE),
+	TSSI_FIELD("5g_2", 3, E_TSSI_TCOMP_5G_2_BASE),
+	TSSI_FIELD("5g_2", 4, E_TSSI_TCOMP_5G_2_BASE),
+	TSSI_FIELD("5g_2", 5, E_TSSI_TCOMP_5G_2_BASE),
+	TSSI_FIELD("5g_2", 6, E_TSSI_TCOMP_5G_2_BASE),
+	TSSI_FIELD("5g_2", 7, E_TSSI_TCOMP_5G_2_BASE),
+	TSSI_FIELD("5g_2", 8, E_TSSI_TCOMP_5G_2_BASE),
+	TSSI_FIELD("5g_2", 9, E_TSSI_TCOMP_5G_2_BASE),
+	TSSI_FIELD("5g_2", 10, E_TSSI_TCOMP_5G_2_BASE),
+	TSSI_FIELD("5g_2", 11, E_TSSI_TCOMP_5G_2_BASE),
+	TSSI_FIELD("5g_2", 12, E_TSSI_TCOMP_5G_2_BASE),
+	TSSI_FIELD("5g_2", 13, E_TSSI_TCOMP_5G_2_BASE),
+	{}
+};
+
+/* EEPROM ranges accessed by the parser */
+static const struct eep_range mt7610_plan[] = {
+	{E_CHIPID, E_TX_AGC_STEP + 2},
+	{E_RATE_PWR_5G_BASE, E_RATE_PWR_5G_VHT_8_9 + 2 - E_RATE_PWR_5G_BASE},
+	{E_USB_VID, E_USB_PID + 2 - E_USB_VID},
+	{}
+};
+
+CHIP(MT7610, 0x7610, mt7610_eep_parse, .plan = mt7610_plan,
+     .fields = mt7610_fields, .txpower_func = mt7610_txpower,
+     .txpower_iter = mt7610_txpower_iter);
@@ -56,4 +56,30 @@ static int mt7620_eep_parse(struct main_ctx *mc)
 	return 0;
 }
 
-CHIP(MT7620, 0x7620, mt7620_eep_parse);
+static const struct eep_field mt7620_fields[] = {
+	EEP_FIELDS_COMMON,
+	EEP_FIELD("nic.cfg0.rx_path", E_NIC_CFG0, E_NIC_CFG0_RX_PATH),
+	EEP_FIELD("nic.cfg0.tx_path", E_NIC_CFG0, E_NIC_CFG0_TX_PATH),
+	EEP_FIELD("nic.cfg1.ext_tx_alc", E_NIC_CFG1, E_NIC_CFG1_EXT_TX_ALC),
+	EEP_FIELD("nic.cfg1.ext_2g_lna", E_NIC_CFG1, E_NIC_CFG1_EXT_2G_LNA),
+	EEP_FIELD("nic.cfg1.40m_2g_sb", E_NIC_CFG1, E_NIC_CFG1_40M_2G_SB),
+	EEP_FIELD("nic.cfg1.wps_but_en", E_NIC_CFG1, E_NIC_CFG1_WPS_BUT_EN),
+	EEP_FIELD("nic.cfg1.40m_2g_dis", E_NIC_CFG1, E_NIC_CFG1_40M_2G_DIS),
+	EEP_FIELD("nic.cfg1.ext_lna", E_NIC_CFG1, E_NIC_CFG1_EXT_LNA),
+	EEP_FIELD("nic.cfg1.int_tx_alc", E_NIC_CFG1, E_NIC_CFG1_INT_TX_ALC),
+	EEP_FIELD("nic.cfg1.tx0_ext_pa", E_NIC_CFG1, E_NIC_CFG1_TX0_EXT_PA),
+	EEP_FIELD("nic.cfg1.tx1_ext_pa", E_NIC_CFG1, E_NIC_CFG1_TX1_EXT_PA),
+	EEP_FIELD("nic.cfg2.rx_stream", E_NIC_CFG2, E_NIC_CFG2_RX_STREAM),
+	EEP_FIELD("nic.cfg2.tx_stream", E_NIC_CFG2, E_NIC_CFG2_TX_STREAM),
+	EEP_FIELD("nic.cfg2.rxtemp_c_dis", E_NIC_CFG2, E_NIC_CFG2_RXTEMP_C_DIS),
+	{}
+};
+
+/* EEPROM ranges accessed by the parser */
+static const struct eep_range mt7620_plan[] = {
+	{E_CHIPID, E_NIC_CFG2 + 2},
+	{}
+};
+
+CHIP(MT7620, 0x7620, mt7620_eep_parse, .plan = mt7620_plan,
+     .fields = mt7620_fields);
@@ -31,4 +31,16 @@ static int mt7628_eep_parse(struct main_ctx *mc)
 	return 0;
 }
 
-CHIP(MT7628, 0x7628, mt7628_eep_parse);
+static const struct eep_field mt7628_fields[] = {
+	EEP_FIELDS_COMMON,
+	{}
+};
+
+/* EEPROM ranges accessed by the parser */
+static const struct eep_range mt7628_plan[] = {
+	{E_CHIPID, E_MACADDR_47_32 + 2},
+	{}
+};
+
+CHIP(MT7628, 0x7628, mt7628_eep_parse, .plan = mt7628_plan,
+     .fields = mt7628_fields);
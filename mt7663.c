@@ -35,4 +35,20 @@ static int mt7663_eep_parse(struct main_ctx *mc)
 	return 0;
 }
 
-CHIP(MT7663, 0x7663, mt7663_eep_parse);
+static const struct eep_field mt7663_fields[] = {
+	EEP_FIELDS_COMMON,
+	EEP_FIELD("pci.dev_id", E_PCI_DEV_ID, 0xffff, .flags = EEP_FF_HEX),
+	EEP_FIELD("pci.ven_id", E_PCI_VEN_ID, 0xffff, .flags = EEP_FF_HEX),
+	EEP_FIELD("pci.sub_dev_id", E_PCI_SUB_DEV_ID, 0xffff, .flags = EEP_FF_HEX),
+	EEP_FIELD("pci.sub_ven_id", E_PCI_SUB_VEN_ID, 0xffff, .flags = EEP_FF_HEX),
+	{}
+};
+
+/* EEPROM ranges accessed by the parser */
+static const struct eep_range mt7663_plan[] = {
+	{E_CHIPID, E_PCI_SUB_VEN_ID + 2},
+	{}
+};
+
+CHIP(MT7663, 0x7663, mt7663_eep_parse, .plan = mt7663_plan,
+     .fields = mt7663_fields);
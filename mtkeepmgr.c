@@ -25,11 +25,20 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <endian.h>
+#include <byteswap.h>
+#include <signal.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include "mtkeepmgr.h"
+#include "field.h"
+#include "trace.h"
+#include "metrics.h"
+#ifdef CONFIG_CON_USB
+#include "usbdb.h"
+#endif
 
 extern struct chip_desc *__start___chips[];
 extern struct chip_desc *__stop___chips;
@@ -39,11 +48,198 @@ extern struct chip_desc *__stop___chips;
 		if ((__chip = __start___chips[i]))	/* to skip possible padding */
 
 extern const struct connector_desc con_file;
+extern const struct connector_desc con_mtd;
+extern const struct connector_desc con_mt76;
 extern const struct connector_desc con_usb;
 
 /* The main utility execution context */
 static struct main_ctx __mc;
 
+TRACE_SEMAPHORE(chip_dispatch);
+TRACE_SEMAPHORE(parse_enter);
+TRACE_SEMAPHORE(parse_exit);
+
+#define EEP_BLK_VALID(__mc, __b)					\
+	((__mc)->eep_valid[(__b) / 32] & 1U << (__b) % 32)
+#define EEP_BLK_SET_VALID(__mc, __b)					\
+	((__mc)->eep_valid[(__b) / 32] |= 1U << (__b) % 32)
+
+/* Fetch [b, e) blocks by transfers of the maximum allowed size */
+static int eep_fetch_blocks(struct main_ctx *mc, unsigned b, unsigned e)
+{
+	unsigned bs = mc->eep_blk_sz, step = mc->eep_xfer_max / bs ? : 1;
+	unsigned n, off, end;
+	int res;
+
+	for (; b < e; b += n) {
+		n = e - b < step ? e - b : step;
+		off = b * bs;
+		end = (b + n) * bs < mc->eep_len ? (b + n) * bs : mc->eep_len;
+		res = mc->con->fetch(mc, off, end - off);
+		if (res)
+			return res;
+		for (off = b; off < b + n; ++off)
+			EEP_BLK_SET_VALID(mc, off);
+	}
+
+	return 0;
+}
+
+/**
+ * Make sure that the specified EEPROM range is available in the buffer. In
+ * the lazy mode missing blocks are fetched from the connector. Sequential
+ * access is detected and served with the doubling read-ahead, so a linear
+ * walk over EEPROM needs only a few transfers.
+ */
+int eep_load(struct main_ctx *mc, unsigned off, unsigned len)
+{
+	unsigned bs = mc->eep_blk_sz, nblk, ra_max, b, e, re, n;
+	int res;
+
+	if (!bs || off >= mc->eep_len || !len)
+		return 0;
+	if (len > mc->eep_len - off)
+		len = mc->eep_len - off;
+
+	nblk = (mc->eep_len + bs - 1) / bs;
+	ra_max = mc->eep_xfer_max / bs ? : 1;
+
+	for (b = off / bs, e = (off + len - 1) / bs + 1; b < e; b = re) {
+		if (EEP_BLK_VALID(mc, b)) {
+			re = b + 1;
+			continue;
+		}
+
+		for (re = b + 1; re < e && !EEP_BLK_VALID(mc, re); ++re);
+
+		if (b == mc->eep_next)
+			mc->eep_ra = mc->eep_ra ? mc->eep_ra * 2 : 1;
+		else
+			mc->eep_ra = 0;
+		if (mc->eep_ra > ra_max)
+			mc->eep_ra = ra_max;
+		for (n = 0; re == e && n < mc->eep_ra && re + n < nblk &&
+			    !EEP_BLK_VALID(mc, re + n); ++n);
+		re += n;
+
+		res = eep_fetch_blocks(mc, b, re);
+		if (res) {
+			mc->eep_err = res;
+			return res;
+		}
+		mc->eep_next = re;
+	}
+
+	return 0;
+}
+
+/* Check whether the range is available without fetching it */
+int eep_is_loaded(struct main_ctx *mc, unsigned off, unsigned len)
+{
+	unsigned bs = mc->eep_blk_sz, b;
+
+	if (off + len > mc->eep_len)
+		return 0;
+	if (!bs)
+		return 1;
+
+	for (b = off / bs; b * bs < off + len; ++b)
+		if (!EEP_BLK_VALID(mc, b))
+			return 0;
+
+	return 1;
+}
+
+/* Transfer latency histogram buckets upper bounds, us */
+const unsigned con_lat_buckets[CON_LAT_NBUCKETS] = {
+	100, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 500000
+};
+
+/* Account a successful transfer of a connector */
+void con_stats_xfer(struct main_ctx *mc, unsigned lat)
+{
+	struct con_stats *cs = &mc->cs;
+	unsigned i;
+
+	for (i = 0; i < CON_LAT_NBUCKETS && lat > con_lat_buckets[i]; ++i);
+	cs->lat_hist[i]++;
+	cs->lat_sum += lat;
+	if (lat > cs->lat_max)
+		cs->lat_max = lat;
+	cs->nxfers++;
+}
+
+#define EEP_MIRROR_PERIOD_MIN	0x100
+
+/**
+ * Fix up EEPROM data obtained from flash dumps: byte swapped words, an
+ * EEPROM image mirrored over the whole buffer and trailing 0xff padding.
+ * The mirroring period is a power of two, so the buffer is mirrored with
+ * a period P if it is equal to itself shifted by P bytes, what is checked
+ * with a single memcmp() per candidate period. Mirrored copies and padding
+ * are only excluded from the decoded length, the data itself is kept, so
+ * the original image could be restored. Should be called once, right after
+ * the data loading. Returns EEP_NORM_xxx flags of the applied fixes. Lazy
+ * mode buffers are never touched since they are fetched from a device, not
+ * a dump.
+ */
+unsigned eep_normalize(struct main_ctx *mc)
+{
+	uint16_t chipid, *w = (uint16_t *)mc->eep_buf;
+	unsigned i, period, flags = 0;
+
+	mc->eep_raw_len = mc->eep_len;
+	mc->eep_norm = 0;
+
+	if (mc->eep_blk_sz || mc->eep_len < 2)
+		return 0;
+
+	chipid = eep_read_word(mc, E_CHIPID);
+	if (!chip_find(chipid) && chip_find(bswap_16(chipid))) {
+		for (i = 0; i < mc->eep_len / 2; ++i)
+			w[i] = bswap_16(w[i]);
+		flags |= EEP_NORM_SWAP;
+	}
+
+	for (period = EEP_MIRROR_PERIOD_MIN; period < mc->eep_len;
+	     period *= 2) {
+		if (mc->eep_len % period)
+			break;
+		if (memcmp(mc->eep_buf, mc->eep_buf + period,
+			   mc->eep_len - period) == 0) {
+			mc->eep_len = period;
+			flags |= EEP_NORM_MIRROR;
+			break;
+		}
+	}
+
+	/* Reads beyond the end return 0xffff anyway, so trim it safely */
+	for (i = mc->eep_len; i > 0 && mc->eep_buf[i - 1] == 0xff; --i);
+	i = (i + 0xf) & ~0xf;
+	if (i && i < mc->eep_len) {
+		mc->eep_len = i;
+		flags |= EEP_NORM_PAD;
+	}
+
+	mc->eep_norm = flags;
+
+	return flags;
+}
+
+/* Swap words of a range back to the original byte order of the dump */
+static void eep_swap_range(struct main_ctx *mc, uint8_t *buf, unsigned off,
+			   unsigned len)
+{
+	unsigned i;
+	uint16_t w;
+
+	for (i = off & ~1; i + 1 < off + len; i += 2) {
+		memcpy(&w, &mc->eep_buf[i], sizeof(w));
+		w = bswap_16(w);
+		memcpy(&buf[i], &w, sizeof(w));
+	}
+}
+
 uint16_t eep_read_word(struct main_ctx *mc, const unsigned offset)
 {
 	uint16_t val;
@@ -51,18 +247,104 @@ uint16_t eep_read_word(struct main_ctx *mc, const unsigned offset)
 	if (offset >= mc->eep_len)
 		return 0xffff;
 
+	if (mc->eep_blk_sz && eep_load(mc, offset, sizeof(val)))
+		return 0xffff;
+
 	memcpy(&val, &mc->eep_buf[offset], sizeof(val));
 
 	return le16toh(val);
 }
 
+struct chip_desc *chip_find(uint16_t chipid)
+{
+	struct chip_desc *chip;
+	int i;
+
+	for_each_chip(chip, i)
+		if (chip->chipid == chipid)
+			return chip;
+
+	return NULL;
+}
+
+struct chip_desc *chip_find_by_name(const char *name)
+{
+	struct chip_desc *chip;
+	int i;
+
+	for_each_chip(chip, i)
+		if (strcasecmp(chip->name, name) == 0)
+			return chip;
+
+	return NULL;
+}
+
+/* Select the chip parser for the EEPROM data and load data it needs */
+static const struct chip_desc *eep_chip_get(struct main_ctx *mc)
+{
+	const struct chip_desc *chip = mc->chip;
+	const struct eep_range *r;
+	uint16_t chipid;
+
+	chipid = eep_read_word(mc, E_CHIPID);
+
+	if (chip && chip->chipid != chipid) {
+		fprintf(stderr, "EEPROM chipid 0x%04x does not match the expected %s chip\n",
+			chipid, chip->name);
+		chip = NULL;
+	}
+	if (!chip)
+		chip = chip_find(chipid);
+	if (!chip) {
+		fprintf(stderr, "EEPROM dump is for unknown or unsupported chip (chipid:0x%04x)\n",
+			chipid);
+		mc->nunknown++;
+		return NULL;
+	}
+
+	for (r = chip->plan; r && r->len; ++r)
+		if (eep_load(mc, r->off, r->len))
+			break;
+
+	return chip;
+}
+
+static const char *eep_norm_str(unsigned norm)
+{
+	static char buf[0x40];
+
+	buf[0] = buf[1] = '\0';
+	if (norm & EEP_NORM_SWAP)
+		strcat(buf, ", byte swap");
+	if (norm & EEP_NORM_MIRROR)
+		strcat(buf, ", mirror");
+	if (norm & EEP_NORM_PAD)
+		strcat(buf, ", padding");
+
+	return &buf[2];
+}
+
+/* Run the chip specific EEPROM parser */
+int chip_parse(struct main_ctx *mc, const struct chip_desc *chip)
+{
+	int res;
+
+	TRACE1(parse_enter, chip->name);
+	res = chip->parse_func(mc);
+	TRACE2(parse_exit, chip->name, res);
+
+	return res;
+}
+
 static int act_eep_dump(struct main_ctx *mc, int argc, char *argv[])
 {
+	const struct chip_desc *chip;
 	uint16_t chipid, version;
-	struct chip_desc *chip = NULL;
-	int i;
 
 	printf("[EEPROM identification]\n");
+	if (mc->eep_norm)
+		printf("  Normalized    : %s (%u bytes)\n",
+		       eep_norm_str(mc->eep_norm), mc->eep_len);
 
 	chipid = eep_read_word(mc, E_CHIPID);
 	printf("  ChipID        : %04Xh\n", chipid);
@@ -71,40 +353,141 @@ static int act_eep_dump(struct main_ctx *mc, int argc, char *argv[])
 	       FIELD_GET(E_VERSION_VERSION, version),
 	       FIELD_GET(E_VERSION_REVISION, version));
 
-	for_each_chip(chip, i)
-		if (chip->chipid == chipid)
-			break;
-
-	if (!chip || chip->chipid != chipid) {
-		fprintf(stderr, "EEPROM dump is for unknown or unsupported chip (chipid:0x%04x)\n",
-			chipid);
+	chip = eep_chip_get(mc);
+	if (!chip)
 		return -1;
-	}
 
 	printf("  Chip          : %s\n", chip->name);
 
 	printf("\n");
 
-	return chip->parse_func(mc);
+	TRACE2(chip_dispatch, chipid, chip->name);
+
+	return chip_parse(mc, chip);
 }
 
+/**
+ * Print values of the specified fields, one per line. In the lazy mode only
+ * blocks holding the fields are fetched, without any read-ahead, and
+ * adjacent blocks are fetched by a single transfer.
+ */
+static int act_get(struct main_ctx *mc, int argc, char *argv[])
+{
+	uint32_t need[ARRAY_SIZE(mc->eep_valid)] = {0};
+	const struct eep_field *fields[argc], *f;
+	const struct chip_desc *chip = mc->chip;
+	unsigned bs = mc->eep_blk_sz, b, e;
+	uint16_t chipid;
+	char buf[0x20];
+	int i, res;
+
+	/* Chip is unknown, so fetch its ID separately */
+	if (!chip) {
+		chipid = eep_read_word(mc, E_CHIPID);
+		if (mc->eep_err)
+			return mc->eep_err;
+		chip = chip_find(chipid);
+		if (!chip) {
+			fprintf(stderr, "EEPROM data are for unknown or unsupported chip (chipid:0x%04x)\n",
+				chipid);
+			mc->nunknown++;
+			return -EINVAL;
+		}
+	}
+
+	for (i = 0; i < argc; ++i) {
+		fields[i] = field_find(chip, argv[i]);
+		if (!fields[i]) {
+			fprintf(stderr, "Unknown %s field -- %s\n", chip->name,
+				argv[i]);
+			return -EINVAL;
+		}
+	}
+
+	/* Collect missing blocks, the chip ID block is always checked */
+	for (i = -1; bs && i < argc; ++i) {
+		f = i < 0 ? NULL : fields[i];
+		b = (f ? f->off : E_CHIPID) / bs;
+		e = ((f ? f->off + field_size(f) : E_CHIPID + 2) - 1) / bs;
+		for (; b <= e; ++b)
+			if (!EEP_BLK_VALID(mc, b))
+				need[b / 32] |= 1U << b % 32;
+	}
+
+	/* Fetch runs of adjacent missing blocks */
+	for (b = 0; bs && b * bs < mc->eep_len; b = e) {
+		for (e = b + 1; need[b / 32] & 1U << b % 32 &&
+				e * bs < mc->eep_len &&
+				need[e / 32] & 1U << e % 32; ++e);
+		if (!(need[b / 32] & 1U << b % 32))
+			continue;
+		res = eep_fetch_blocks(mc, b, e);
+		if (res) {
+			mc->eep_err = res;
+			return res;
+		}
+	}
+
+	chipid = eep_read_word(mc, E_CHIPID);
+	if (chipid != chip->chipid) {
+		fprintf(stderr, "EEPROM chipid 0x%04x does not match the expected %s chip\n",
+			chipid, chip->name);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < argc; ++i)
+		printf("%s\n", field_str(mc, fields[i], buf, sizeof(buf)));
+
+	return 0;
+}
+
+static int act_txpower(struct main_ctx *mc, int argc, char *argv[])
+{
+	const struct chip_desc *chip = eep_chip_get(mc);
+
+	if (!chip)
+		return -1;
+
+	if (!chip->txpower_func) {
+		fprintf(stderr, "Tx power computation is not supported for %s chip\n",
+			chip->name);
+		return -EINVAL;
+	}
+
+	return chip->txpower_func(mc, argc, argv);
+}
+
+/* Save the data as they were loaded, without the dump normalization */
 static int act_eep_save(struct main_ctx *mc, int argc, char *argv[])
 {
+	uint8_t raw[sizeof(mc->eep_buf)];
 	FILE *fp;
 	const uint8_t *buf = mc->eep_buf;
-	int eep_len = mc->eep_len;
+	int eep_len = mc->eep_raw_len ? : mc->eep_len;
 	size_t res;
+	int err;
 
 	if (argc < 1) {
 		fprintf(stderr, "Output file for EEPROM saving is not specified, aborting\n");
 		return -EINVAL;
 	}
 
+	if (eep_load(mc, 0, eep_len)) {
+		fprintf(stderr, "Unable to fetch whole EEPROM contents\n");
+		return -EIO;
+	}
+
+	if (mc->eep_norm & EEP_NORM_SWAP) {
+		eep_swap_range(mc, raw, 0, eep_len);
+		buf = raw;
+	}
+
 	fp = fopen(argv[0], "wb");
 	if (!fp) {
+		err = errno;
 		fprintf(stderr, "Unable to open output file for writing: %s\n",
-			strerror(errno));
-		return -errno;
+			strerror(err));
+		return -err;
 	}
 
 	res = fwrite(buf, 1, eep_len, fp);
@@ -117,8 +500,270 @@ static int act_eep_save(struct main_ctx *mc, int argc, char *argv[])
 	return res == eep_len ? 0 : -EIO;
 }
 
+#define WATCH_INTERVAL_MAX	(24 * 3600 * 1000)	/* 1 day, ms */
+
+static volatile sig_atomic_t watch_stop;
+
+static void watch_sigint(int signum)
+{
+	watch_stop = 1;
+}
+
+/* Print field level changes of the [off, off + len) range */
+static void eep_diff_report(struct main_ctx *old, struct main_ctx *mc,
+			    unsigned off, unsigned len)
+{
+	const struct chip_desc *chip = chip_find(eep_read_word(old, E_CHIPID));
+	const struct eep_field *f;
+	char obuf[0x20], nbuf[0x20];
+	uint16_t oval, nval, mask;
+	unsigned i;
+
+	for_each_field(chip, f) {
+		if (f->off + field_size(f) <= off || f->off >= off + len)
+			continue;
+		field_str(old, f, obuf, sizeof(obuf));
+		field_str(mc, f, nbuf, sizeof(nbuf));
+		if (strcmp(obuf, nbuf) != 0)
+			printf("  %-24s: %s -> %s\n", f->name, obuf, nbuf);
+	}
+
+	/* Report changed bits, which are not covered by known fields */
+	for (i = off & ~1; i < off + len; i += 2) {
+		oval = eep_read_word(old, i);
+		nval = eep_read_word(mc, i);
+		mask = 0;
+		for_each_field(chip, f)
+			if (f->off <= i && i < f->off + field_size(f))
+				mask |= f->flags & EEP_FF_MACADDR ? 0xffff :
+								    f->mask;
+		if ((oval ^ nval) & ~mask)
+			printf("  %04Xh%19s: %04Xh -> %04Xh\n", i, "", oval,
+			       nval);
+	}
+}
+
+/**
+ * Periodically refetch EEPROM blocks and report changes. There are no way
+ * to ask a device for a block checksum, so each poll refetches only a few
+ * blocks in a round-robin manner to keep the connector load low.
+ */
+static int act_watch(struct main_ctx *mc, int argc, char *argv[])
+{
+	unsigned long interval = 1000, nblk = 4;
+	unsigned bs, total, cur = 0, off, len, i;
+	struct main_ctx *old;
+	struct timespec ts;
+	char tstr[0x20], *endp;
+	time_t now;
+	int res = 0;
+
+	if (argc >= 1) {
+		interval = strtoul(argv[0], &endp, 0);
+		if (argv[0][0] == '-' || *endp != '\0')
+			interval = 0;
+	}
+	if (argc >= 2) {
+		nblk = strtoul(argv[1], &endp, 0);
+		if (argv[1][0] == '-' || *endp != '\0')
+			nblk = 0;
+	}
+	if (!interval || interval > WATCH_INTERVAL_MAX || !nblk) {
+		fprintf(stderr, "Invalid watch interval or number of blocks\n");
+		return -EINVAL;
+	}
+	ts.tv_sec = interval / 1000;
+	ts.tv_nsec = interval % 1000 * 1000000;
+
+	if (!mc->con->fetch) {
+		fprintf(stderr, "%s connector does not support data refetching\n",
+			mc->con->name);
+		return -EINVAL;
+	}
+
+	if (eep_load(mc, 0, mc->eep_len))
+		return -EIO;
+
+	old = malloc(sizeof(*old));
+	if (!old) {
+		fprintf(stderr, "Unable to allocate memory for EEPROM snapshot\n");
+		return -ENOMEM;
+	}
+	memcpy(old, mc, sizeof(*old));
+	old->eep_blk_sz = 0;		/* Snapshot is always complete */
+
+	bs = mc->eep_blk_sz ? : 0x20;
+	total = (mc->eep_len + bs - 1) / bs;
+	if (nblk > total)
+		nblk = total;
+
+	printf("Watching %u bytes of EEPROM, %lu of %u blocks per %lu ms\n",
+	       mc->eep_len, nblk, total, interval);
+	fflush(stdout);
+
+	signal(SIGINT, watch_sigint);
+	signal(SIGTERM, watch_sigint);
+
+	while (!watch_stop) {
+		nanosleep(&ts, NULL);	/* Interrupted by a signal to stop */
+		for (i = 0; i < nblk && !watch_stop; ++i) {
+			off = cur * bs;
+			len = mc->eep_len - off < bs ? mc->eep_len - off : bs;
+			cur = (cur + 1) % total;
+
+			res = mc->con->fetch(mc, off, len);
+			if (res)
+				goto exit;
+			if (mc->eep_norm & EEP_NORM_SWAP)
+				eep_swap_range(mc, mc->eep_buf, off, len);
+			if (memcmp(&old->eep_buf[off], &mc->eep_buf[off],
+				   len) == 0)
+				continue;
+
+			now = time(NULL);
+			strftime(tstr, sizeof(tstr), "%F %T", localtime(&now));
+			printf("[%s] EEPROM changed at %04Xh-%04Xh\n", tstr,
+			       off, off + len - 1);
+			eep_diff_report(old, mc, off, len);
+			fflush(stdout);
+
+			memcpy(&old->eep_buf[off], &mc->eep_buf[off], len);
+		}
+
+		if (mc->metrics_file)
+			metrics_write(mc, 0);
+	}
+
+exit:
+	free(old);
+
+	return res;
+}
+
+/**
+ * Compare EEPROM data against a golden image block by block as blocks are
+ * fetched from the data source. In the lazy mode a mismatched unit is thus
+ * rejected after the first mismatched block without a full EEPROM readout.
+ * The optional budget specifies how many mismatched bytes are tolerated
+ * before giving up. The whole raw golden image is compared, only its byte
+ * order is fixed, and a size mismatch fails the verification.
+ */
+static int act_verify(struct main_ctx *mc, int argc, char *argv[])
+{
+	unsigned budget = 0, nbad = 0, bs, off, len = 0, beg, end = 0, i, n;
+	struct main_ctx *gold;
+	ssize_t res;
+	int fd, err;
+	char *endp;
+
+	if (argc >= 2) {
+		budget = strtoul(argv[1], &endp, 0);
+		if (argv[1][0] == '\0' || argv[1][0] == '-' || *endp != '\0') {
+			fprintf(stderr, "Invalid mismatch budget -- %s\n",
+				argv[1]);
+			return -EINVAL;
+		}
+	}
+
+	gold = calloc(1, sizeof(*gold));
+	if (!gold) {
+		fprintf(stderr, "Unable to allocate memory for golden image\n");
+		return -ENOMEM;
+	}
+
+	fd = open(argv[0], O_RDONLY);
+	if (fd == -1) {
+		err = errno;
+		fprintf(stderr, "Unable to open golden image '%s': %s\n",
+			argv[0], strerror(err));
+		free(gold);
+		return -err;
+	}
+	res = read(fd, gold->eep_buf, sizeof(gold->eep_buf));
+	if (res < 0)
+		fprintf(stderr, "Unable to read golden image '%s': %s\n",
+			argv[0], strerror(errno));
+	close(fd);
+	if (res < 0) {
+		free(gold);
+		return -EIO;
+	}
+	/* Only fix the byte order, the whole image is compared */
+	gold->eep_len = res & ~1;
+	eep_normalize(gold);
+	gold->eep_len = gold->eep_raw_len;
+
+	if (gold->eep_len != mc->eep_raw_len) {
+		printf("Verification FAILED: golden image size differs from EEPROM (%u bytes vs %u bytes)\n",
+		       gold->eep_len, mc->eep_raw_len);
+		nbad = budget + 1;
+		goto exit;
+	}
+
+	bs = mc->eep_blk_sz ? : 0x20;
+	for (off = 0; off < gold->eep_len; off += bs) {
+		len = gold->eep_len - off < bs ? gold->eep_len - off : bs;
+		if (eep_load(mc, off, len))
+			break;
+		if (memcmp(&gold->eep_buf[off], &mc->eep_buf[off], len) == 0)
+			continue;
+
+		for (i = off, n = 0, beg = ~0U; i < off + len; ++i) {
+			if (gold->eep_buf[i] == mc->eep_buf[i])
+				continue;
+			if (beg == ~0U)
+				beg = i;
+			end = i;
+			n++;
+		}
+		printf("Mismatch at %04Xh-%04Xh (%u bytes)\n", beg, end, n);
+		eep_diff_report(gold, mc, beg, end - beg + 1);
+
+		nbad += n;
+		if (nbad > budget)
+			break;
+	}
+
+	if (mc->eep_err) {
+		printf("Verification aborted after %u bytes\n", off);
+		goto exit;
+	}
+
+	if (nbad > budget)
+		printf("Verification FAILED: %u mismatched bytes within %u bytes (budget %u)\n",
+		       nbad, off + len, budget);
+	else
+		printf("Verification passed: %u mismatched bytes within %u bytes (budget %u)\n",
+		       nbad, gold->eep_len, budget);
+
+exit:
+	free(gold);
+
+	return nbad > budget || mc->eep_err ? -EIO : 0;
+}
+
+static int act_scan(struct main_ctx *mc, int argc, char *argv[])
+{
+	if (!mc->con || !mc->con->scan) {
+		fprintf(stderr, "Connector does not support devices scanning\n");
+		return -EINVAL;
+	}
+
+	return mc->con->scan(mc, mc->con_arg);
+}
+
+#define ACT_F_NOINIT	0x0001	/* Action does not need connector init */
+#define ACT_F_NOCON	0x0002	/* Action does not use connector at all */
+
+#define ACT_ARGS_ANY	-1	/* Action consumes all remaining arguments */
+
+#define ACT_CHAIN_MAX	16	/* Max number of actions in a command line */
+
 static const struct action {
 	const char * const name;
+	unsigned flags;
+	int min_args;
+	int max_args;
 	int (*func)(struct main_ctx *mc, int argc, char *argv[]);
 } actions[] = {
 	{
@@ -126,25 +771,99 @@ static const struct action {
 		.func = act_eep_dump,
 	}, {
 		.name = "save",
+		.min_args = 1,
+		.max_args = 1,
 		.func = act_eep_save,
+	}, {
+		.name = "scan",
+		.flags = ACT_F_NOINIT,
+		.func = act_scan,
+	}, {
+		.name = "watch",
+		.max_args = 2,
+		.func = act_watch,
+	}, {
+		.name = "verify-against",
+		.min_args = 1,
+		.max_args = 2,
+		.func = act_verify,
+	}, {
+		.name = "get",
+		.min_args = 1,
+		.max_args = ACT_ARGS_ANY,
+		.func = act_get,
+	}, {
+		.name = "txpower",
+		.max_args = 2,
+		.func = act_txpower,
+#ifdef CONFIG_BATCH
+	}, {
+		.name = "conform",
+		.flags = ACT_F_NOINIT | ACT_F_NOCON,
+		.min_args = 2,
+		.max_args = ACT_ARGS_ANY,
+		.func = act_conform,
+	}, {
+		.name = "stats",
+		.flags = ACT_F_NOINIT | ACT_F_NOCON,
+		.min_args = 1,
+		.max_args = ACT_ARGS_ANY,
+		.func = act_stats,
+	}, {
+		.name = "compare",
+		.flags = ACT_F_NOINIT | ACT_F_NOCON,
+		.min_args = 2,
+		.max_args = ACT_ARGS_ANY,
+		.func = act_compare,
+	}, {
+		.name = "archive",
+		.flags = ACT_F_NOINIT | ACT_F_NOCON,
+		.min_args = 1,
+		.max_args = ACT_ARGS_ANY,
+		.func = act_archive,
+	}, {
+		.name = "extract",
+		.flags = ACT_F_NOINIT | ACT_F_NOCON,
+		.min_args = 1,
+		.max_args = 3,
+		.func = act_extract,
+	}, {
+		.name = "index",
+		.flags = ACT_F_NOINIT | ACT_F_NOCON,
+		.min_args = 2,
+		.max_args = ACT_ARGS_ANY,
+		.func = act_index,
+	}, {
+		.name = "similar",
+		.flags = ACT_F_NOINIT | ACT_F_NOCON,
+		.min_args = 2,
+		.max_args = ACT_ARGS_ANY,
+		.func = act_similar,
+#endif
+	}, {
+		.name = "locate",
+		.flags = ACT_F_NOINIT,
+		.max_args = 2,
+		.func = act_locate,
 	}
 };
 
 #define CON_USAGE_FILE	"-F <eepdump>"
+#define CON_USAGE_MTD	" | -M <dev>[:<off>[:<len>]]"
+#define CON_USAGE_MT76	" | -P <phy>"
 #ifdef CONFIG_CON_USB
 #define CON_USAGE_USB	" | -U <dev-sel>"
-#define CON_OPTSTR_USB	"U:"
+#define CON_OPTSTR_USB	"U:D:C:"
+#define OPT_USAGE_USB	" [-D <devdb>] [-C <cachedir>]"
 #else
 #define CON_USAGE_USB	""
 #define CON_OPTSTR_USB	""
+#define OPT_USAGE_USB	""
 #endif
 
-#define CON_OPTSTR	"F:" CON_OPTSTR_USB
-#if defined(CONFIG_CON_USB)
-#define CON_USAGE	"{" CON_USAGE_FILE CON_USAGE_USB "}"
-#else
-#define CON_USAGE	CON_USAGE_FILE
-#endif
+#define CON_OPTSTR	"F:M:P:" CON_OPTSTR_USB
+#define CON_USAGE	"{" CON_USAGE_FILE CON_USAGE_MTD CON_USAGE_MT76	\
+			CON_USAGE_USB "}"
 
 static void usage_chips(void)
 {
@@ -163,11 +882,21 @@ static void usage(const char *name)
 		"Copyright (c) 2016-2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>\n"
 		"\n"
 		"Usage:\n"
-		"  %s [-h] " CON_USAGE " [<action> [<actarg>]]\n"
+		"  %s [-h] [-m <file>]" OPT_USAGE_USB " " CON_USAGE " [<action> [<actarg>]] ...\n"
 		"\n"
 		"Options:\n"
 		"  -F <eepdump>\n"
 		"           Read EEPROM dump from <eepdump> file.\n"
+		"  -M <dev>[:<off>[:<len>]]\n"
+		"           Read EEPROM data from a MTD device, a block device or a file\n"
+		"           <dev>, starting at offset <off> (default: 0) and limited by\n"
+		"           <len> bytes (default: up to 4 KiB). Only the specified window is\n"
+		"           read. <dev> could be a path, an MTD device name (e.g. mtd2) or\n"
+		"           an MTD partition name from /proc/mtd (e.g. factory).\n"
+		"  -P <phy>\n"
+		"           Read EEPROM data, which are used by the mt76 driver for the\n"
+		"           wireless PHY <phy>, from debugfs. <phy> could be a PHY name (e.g.\n"
+		"           phy0) or an index (e.g. 0). Device remains fully operational.\n"
 #ifdef CONFIG_CON_USB
 		"  -U <dev-sel>\n"
 		"           Work with USB device, which is specified by a selector <dev-sel>.\n"
@@ -200,11 +929,40 @@ static void usage(const char *name)
 		"           will open first device with a known VID/PID pair. This is useful\n"
 		"           when you have only one device connected to the host and you do not\n"
 		"           want to type a longer option argument.\n"
+		"           Failed or short EEPROM reads are retried with a timeout adapted to\n"
+		"           the observed device latency. If the 'reset' keyword is added to\n"
+		"           the selector (e.g. any,reset), then the device is reset once when\n"
+		"           retries do not help.\n"
+		"  -D <devdb>\n"
+		"           Load USB devices database from the <devdb> file to extend the\n"
+		"           utility table of supported devices. Each line of the file has the\n"
+		"           '<VID>:<PID> <chip> <eepsize> <xfersize>' format, where <chip> is\n"
+		"           one of supported chips (see below), <eepsize> is the EEPROM size and\n"
+		"           <xfersize> is the maximum safe EEPROM read transfer size. Unknown\n"
+		"           fields could be specified as '-'. Known EEPROM size allows the\n"
+		"           utility to avoid the EEPROM size detection.\n"
+		"  -C <cachedir>\n"
+		"           Cache USB device EEPROM data in the <cachedir> directory (e.g.\n"
+		"           on tmpfs). Cache entries are keyed by the device VID/PID, bus\n"
+		"           path and serial number. A cached entry is validated by reading\n"
+		"           the first EEPROM block only, so repeated invocations for the\n"
+		"           same device avoid the full EEPROM readout.\n"
 #endif
+		"  -m <file>[,<field>[,<field>...]]\n"
+		"           Write metrics in the Prometheus text format (e.g. for the\n"
+		"           node_exporter textfile collector) to the <file> on exit and after\n"
+		"           each watch iteration. The file is replaced atomically. Metrics\n"
+		"           include transfer latency histogram, retries counters, device\n"
+		"           identification and values of calibration fields, which names\n"
+		"           match any of <field> patterns (default: freq_offset, temp_offset,\n"
+		"           xtal_opt, tgtpwr.*).\n"
 		"  -h       Print this help\n"
 		"  <action> Optional argument, which specifies the <action> that should be\n"
 		"           performed (see actions list below). If no action is specified, then\n"
-		"           the 'dump' action is performed by default.\n"
+		"           the 'dump' action is performed by default. Several actions could be\n"
+		"           specified, they are performed in order using the same EEPROM data\n"
+		"           (e.g. 'dump save unit.bin'), so the device is read only once. An\n"
+		"           action name ends the previous action arguments list.\n"
 		"  <actarg> Action argument if the action accepts any (see details below in the\n"
 		"           detailed actions list).\n"
 		"\n"
@@ -213,6 +971,78 @@ static void usage(const char *name)
 		"           terminal (this is the default action).\n"
 		"  save <file>\n"
 		"           Save fetched raw EEPROM content to the file <file>.\n"
+		"  scan     List all devices that are matched by the connector selector\n"
+		"           with their chip ID, EEPROM version and MAC address. Only\n"
+		"           a few first EEPROM bytes of each device are read (USB only).\n"
+		"  watch [<interval> [<nblocks>]]\n"
+		"           Keep the data source open and each <interval> milliseconds\n"
+		"           (default: 1000) refetch next <nblocks> blocks (default: 4) of\n"
+		"           EEPROM data. Changes are reported field by field. Press Ctrl+C\n"
+		"           to stop watching.\n"
+		"  get <field> [<field> ...]\n"
+		"           Print values of the named EEPROM fields (e.g. macaddr,\n"
+		"           nic.cfg0.tx_path, country.5g), one value per line. Only the\n"
+		"           EEPROM blocks holding the fields are read from a device.\n"
+		"  verify-against <golden> [<budget>]\n"
+		"           Compare EEPROM data against the <golden> image block by block\n"
+		"           while fetching them from the device and stop as soon as more\n"
+		"           than <budget> bytes (default: 0) mismatch. Mismatched fields are\n"
+		"           reported. Fails if EEPROM data do not match the golden image.\n"
+		"  txpower [table|csv [<temp>]]\n"
+		"           Compute effective Tx power for each channel, rate group and\n"
+		"           bandwidth from the per channel, per rate and bandwidth delta\n"
+		"           tables and print it as a table (default) or in the CSV format.\n"
+		"           If the temperature sensor reading <temp> is specified, then\n"
+		"           the TSSI temperature compensation is applied too (MT7610 only).\n"
+#ifdef CONFIG_BATCH
+		"  conform <limits> <image>|<dir> [<image>|<dir> ...]\n"
+		"           Check effective Tx power (see txpower action) of each EEPROM\n"
+		"           image against the regulatory limits database <limits> and\n"
+		"           report violations. Directories are scanned recursively. No\n"
+		"           connector is needed. Each line of the <limits> file has the\n"
+		"           '<band> <region> <channels> <bw> <rate> <limit>' format, where\n"
+		"           <band> is 2 or 5, <region> is a country region code or '*',\n"
+		"           <channels> is a channel or a range (e.g. 36-64), <bw> is a\n"
+		"           bandwidth (MHz) or '*', <rate> is a rate group or '*' and\n"
+		"           <limit> is a maximum power in dBm.\n"
+		"  stats [text|json] [fields=<pattern>] [threads=<n>] <image>|<dir> ...\n"
+		"           Collect statistics of EEPROM fields values over a batch of\n"
+		"           EEPROM images: count, min, max, mean, standard deviation and\n"
+		"           a histogram. Fields could be limited by a shell-style name\n"
+		"           <pattern> (e.g. 'txpwr.5g.*'). Images are processed by <n>\n"
+		"           threads (default: number of CPUs). No connector is needed.\n"
+		"  compare <golden> [rules=<file>] [tol:<pattern>=<tol> ...] [top=<n>]\n"
+		"          [threads=<n>] <image>|<dir> ...\n"
+		"           Compare EEPROM fields of each image against the <golden> one\n"
+		"           and report how many units fail each field and the <n> worst\n"
+		"           units (default: 10). Fields are compared exactly unless a\n"
+		"           tolerance rule matches the field name. Rules are specified in\n"
+		"           the command line (e.g. tol:txpwr.5g.*=1) or in a <file> with\n"
+		"           '<pattern> <tol>' lines. The first matching rule wins, '-'\n"
+		"           tolerance excludes matched fields. No connector is needed.\n"
+		"  archive <archive> [base=<image> ...] <image>|<dir> ...\n"
+		"           Append images to the <archive> file. Each image is stored as a\n"
+		"           sparse word level delta against a baseline image of the same\n"
+		"           chip ID and EEPROM version. Baselines could be specified\n"
+		"           explicitly, otherwise the first image of a new chip ID and\n"
+		"           version becomes the baseline. No connector is needed.\n"
+		"  extract <archive> [<dir> [<pattern>]]\n"
+		"           List images stored in the <archive> or reconstruct images,\n"
+		"           which names match the <pattern> (default: all), to <dir>.\n"
+		"  index <index> [threads=<n>] <image>|<dir> ...\n"
+		"           Build a similarity search index of calibration data (power\n"
+		"           tables, rate deltas, LNA gains, RSSI and frequency offsets) of\n"
+		"           images of the same chip as the first image.\n"
+		"  similar <image> [top=<k>] [threads=<n>] <index>|<image>|<dir> ...\n"
+		"           Find <k> images (default: 10) with the calibration data most\n"
+		"           similar to the <image> one in the index or in the images.\n"
+#endif
+		"  locate [<stride> [<minscore>]]\n"
+		"           Search a full flash image, specified with the -F option, for\n"
+		"           EEPROM data of known chips. Candidates are checked at each\n"
+		"           <stride> bytes (default: 0x200), scored by MAC address and\n"
+		"           version sanity and then candidates scored at least <minscore>\n"
+		"           points (default: 2) are listed and decoded.\n"
 		"\n",
 		name
 	);
@@ -222,31 +1052,95 @@ static void usage(const char *name)
 	printf("\n\n");
 }
 
+static const struct action *action_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(actions); ++i)
+		if (strcasecmp(name, actions[i].name) == 0)
+			return &actions[i];
+
+	return NULL;
+}
+
+/**
+ * Run a connector-less (batch) action with its own context, since batch
+ * actions load images into the EEPROM buffer of the context, which would
+ * otherwise clobber the device data used by the rest of the chain.
+ */
+static int action_run_isolated(const struct action *act, int argc,
+			       char *argv[])
+{
+	struct main_ctx *bmc;
+	int ret;
+
+	bmc = calloc(1, sizeof(*bmc));
+	if (!bmc) {
+		fprintf(stderr, "Unable to allocate memory for the '%s' action context\n",
+			act->name);
+		return -ENOMEM;
+	}
+
+	ret = act->func(bmc, argc, argv);
+
+	free(bmc);
+
+	return ret;
+}
+
 int main(int argc, char *argv[])
 {
 	const char *appname = basename(argv[0]);
 	struct main_ctx *mc = &__mc;
-	const struct action *act = NULL;
-	char *con_arg = NULL;
-	int i, opt, ret = -EINVAL;
+	struct {
+		const struct action *act;
+		int argc;
+		char **argv;
+	} chain[ACT_CHAIN_MAX], *ai;
+	const struct action *act;
+	char *con_arg = NULL, *p;
+	int i, opt, nchain = 0, inited = 0, ret = -EINVAL;
 
 	if (argc <= 1) {
 		usage(appname);
 		return EXIT_SUCCESS;
 	}
 
-	while ((opt = getopt(argc, argv, CON_OPTSTR "h")) != -1) {
+	while ((opt = getopt(argc, argv, CON_OPTSTR "m:h")) != -1) {
 		switch (opt) {
 		case 'F':
 			mc->con = &con_file;
 			con_arg = optarg;
 			break;
+		case 'M':
+			mc->con = &con_mtd;
+			con_arg = optarg;
+			break;
+		case 'P':
+			mc->con = &con_mt76;
+			con_arg = optarg;
+			break;
 #ifdef CONFIG_CON_USB
 		case 'U':
 			mc->con = &con_usb;
 			con_arg = optarg;
 			break;
+		case 'D':
+			if (usbdb_load(optarg))
+				return EXIT_FAILURE;
+			break;
+		case 'C':
+			mc->cache_dir = optarg;
+			break;
 #endif
+		case 'm':
+			mc->metrics_file = optarg;
+			p = strchr(optarg, ',');
+			if (p) {
+				*p = '\0';
+				mc->metrics_fields = p + 1;
+			}
+			break;
 		case 'h':
 			usage(appname);
 			return EXIT_SUCCESS;
@@ -255,40 +1149,86 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (!mc->con) {
-		fprintf(stderr, "Connector (data source) was not specified\n");
-		goto exit;
-	}
-
-	if (optind >= argc) {
-		act = &actions[0];	/* Select first action by default */
-	} else {
-		for (i = 0; i < ARRAY_SIZE(actions); ++i) {
-			if (strcasecmp(argv[optind], actions[i].name) != 0)
-				continue;
-			act = &actions[i];
-			break;
-		}
+	/* Split remaining arguments to the actions chain */
+	while (optind < argc) {
+		act = action_find(argv[optind]);
 		if (!act) {
 			fprintf(stderr, "Unknown action -- %s\n", argv[optind]);
 			goto exit;
 		}
-		optind++;
+		if (nchain == ACT_CHAIN_MAX) {
+			fprintf(stderr, "Too many actions, at most %d are supported\n",
+				ACT_CHAIN_MAX);
+			goto exit;
+		}
+		ai = &chain[nchain++];
+		ai->act = act;
+		ai->argv = &argv[++optind];
+		ai->argc = 0;
+		/* Next action name ends the arguments list (use ./name for files) */
+		while (optind < argc && !action_find(argv[optind]) &&
+		       (act->max_args == ACT_ARGS_ANY ||
+			ai->argc < act->max_args)) {
+			ai->argc++;
+			optind++;
+		}
+		if (ai->argc < act->min_args) {
+			fprintf(stderr, "Too few arguments for the '%s' action\n",
+				act->name);
+			goto exit;
+		}
+	}
+	if (!nchain) {
+		chain[0].act = &actions[0];	/* Select first action by default */
+		nchain = 1;
+	}
+
+	for (i = 0; i < nchain; ++i)
+		if (!(chain[i].act->flags & ACT_F_NOCON))
+			break;
+	if (i == nchain) {			/* Connector is not needed */
+		for (i = 0, ret = 0; i < nchain && !ret; ++i)
+			ret = chain[i].act->func(mc, chain[i].argc,
+						 chain[i].argv);
+		goto exit;
 	}
 
+	if (!mc->con) {
+		fprintf(stderr, "Connector (data source) was not specified\n");
+		goto exit;
+	}
+
+	mc->con_arg = con_arg;
 	mc->con_priv = malloc(mc->con->priv_sz);
 	if (!mc->con_priv) {
 		fprintf(stderr, "Unable to allocate memory for a connector private data\n");
 		goto exit;
 	}
 
-	ret = mc->con->init(mc, con_arg);
-	if (ret)
-		goto exit;
+	/* Actions share a single connector session and EEPROM buffer */
+	for (i = 0, ret = 0; i < nchain && !ret; ++i) {
+		ai = &chain[i];
+		if (ai->act->flags & ACT_F_NOCON) {
+			ret = action_run_isolated(ai->act, ai->argc, ai->argv);
+			continue;
+		}
+		if (!(ai->act->flags & ACT_F_NOINIT) && !inited) {
+			ret = mc->con->init(mc, con_arg);
+			if (ret)
+				break;
+			inited = 1;
+			eep_normalize(mc);	/* Fix up dumps once */
+		}
+		ret = ai->act->func(mc, ai->argc, ai->argv);
+		if (!ret && mc->eep_err)
+			ret = mc->eep_err;	/* Report lazy fetching failure */
+	}
 
-	ret = act->func(mc, argc - optind, argv + optind);
+	if (mc->metrics_file)
+		metrics_write(mc, ret);
 
-	mc->con->clean(mc);
+	if (inited)
+		mc->con->clean(mc);
 
 exit:
 	free(mc->con_priv);
@@ -44,38 +44,160 @@
 struct main_ctx;
 
 uint16_t eep_read_word(struct main_ctx *mc, const unsigned offset);
+int eep_load(struct main_ctx *mc, unsigned off, unsigned len);
+int eep_is_loaded(struct main_ctx *mc, unsigned off, unsigned len);
+
+#define EEP_NORM_SWAP		0x0001	/* Words were byte swapped */
+#define EEP_NORM_MIRROR		0x0002	/* Mirrored copies were dropped */
+#define EEP_NORM_PAD		0x0004	/* Trailing padding was dropped */
+
+unsigned eep_normalize(struct main_ctx *mc);
+
+/* EEPROM data range */
+struct eep_range {
+	uint16_t off;
+	uint16_t len;
+};
+
+/* EEPROM field flags */
+#define EEP_FF_HEX		0x0001	/* Print value in hex form */
+#define EEP_FF_SIGNED		0x0002	/* Value is a two's complement number */
+#define EEP_FF_HALF		0x0004	/* Value is in 0.5 units (dB, dBm) */
+#define EEP_FF_MACADDR		0x0008	/* MAC address (3 words at offset) */
+
+/* Named EEPROM field (a part of an EEPROM word) */
+struct eep_field {
+	const char *name;		/* Dotted name, e.g. nic.cfg0.tx_path */
+	uint16_t off;			/* Word offset */
+	uint16_t mask;			/* Field bits in the word */
+	unsigned flags;			/* See EEP_FF_xxx */
+	int (*decode)(unsigned raw);	/* Custom value decoder (optional) */
+};
+
+#define EEP_FIELD(__name, __off, __mask, ...)				\
+	{ .name = __name, .off = __off, .mask = __mask, __VA_ARGS__ }
+
+/* Fields that are common for all chips */
+#define EEP_FIELDS_COMMON						\
+	EEP_FIELD("chipid", E_CHIPID, 0xffff, .flags = EEP_FF_HEX),	\
+	EEP_FIELD("version.version", E_VERSION, E_VERSION_VERSION),	\
+	EEP_FIELD("version.revision", E_VERSION, E_VERSION_REVISION),	\
+	EEP_FIELD("macaddr", E_MACADDR_15_00, 0xffff,			\
+		  .flags = EEP_FF_MACADDR)
+
+/* Effective Tx power of a channel, rate group and bandwidth */
+struct txpwr_point {
+	unsigned band;			/* 2 - 2.4 GHz, 5 - 5 GHz */
+	unsigned chan;			/* Channel number */
+	unsigned bw;			/* Bandwidth, MHz */
+	const char *rate;		/* Rate group name, e.g. MCS0 */
+	int pwr;			/* Power, 0.5 dBm */
+};
 
 struct chip_desc {
 	const char *name;
 	uint16_t chipid;
 	int (*parse_func)(struct main_ctx *mc);
+	/* Ranges accessed by the parser, terminated by a zero length range */
+	const struct eep_range *plan;
+	/* Known fields, terminated by an empty entry */
+	const struct eep_field *fields;
+	/* Effective Tx power computation, optional */
+	int (*txpower_func)(struct main_ctx *mc, int argc, char *argv[]);
+	/* Effective Tx power points iteration, optional */
+	int (*txpower_iter)(struct main_ctx *mc,
+			    void (*cb)(const struct txpwr_point *pt, void *priv),
+			    void *priv);
 };
 
-#define CHIP(__name, __chipid, __parse_func)				\
+/* Optional fields could be specified as extra designated initializers */
+#define CHIP(__name, __chipid, __parse_func, ...)			\
 	static struct chip_desc __chip_ ## __name = {			\
 		.name = #__name,					\
 		.chipid = __chipid,					\
 		.parse_func = __parse_func,				\
+		__VA_ARGS__						\
 	};								\
 	static struct chip_desc *__chip_ ## __name ## __ptr		\
 	__attribute__((used, section(("__chips")))) = 			\
 	&__chip_ ## __name
 
+struct chip_desc *chip_find(uint16_t chipid);
+struct chip_desc *chip_find_by_name(const char *name);
+int chip_parse(struct main_ctx *mc, const struct chip_desc *chip);
+
+/* Actions implemented in separate modules */
+int act_locate(struct main_ctx *mc, int argc, char *argv[]);
+int act_conform(struct main_ctx *mc, int argc, char *argv[]);
+int act_stats(struct main_ctx *mc, int argc, char *argv[]);
+int act_compare(struct main_ctx *mc, int argc, char *argv[]);
+int act_archive(struct main_ctx *mc, int argc, char *argv[]);
+int act_extract(struct main_ctx *mc, int argc, char *argv[]);
+int act_index(struct main_ctx *mc, int argc, char *argv[]);
+int act_similar(struct main_ctx *mc, int argc, char *argv[]);
+
 struct connector_desc {
 	const char * const name;
 	size_t priv_sz;
 
 	int (*init)(struct main_ctx *mc, const char *arg_str);
 	void (*clean)(struct main_ctx *mc);
+	/* Fetch EEPROM data to the buffer, used in the lazy mode */
+	int (*fetch)(struct main_ctx *mc, unsigned off, unsigned len);
+	/* List all devices matched by the connector argument */
+	int (*scan)(struct main_ctx *mc, const char *arg_str);
 };
 
+#define EEP_BLK_SZ_MIN		0x10	/* Minimal lazy mode block size */
+
+#define CON_LAT_NBUCKETS	10	/* Transfer latency histogram buckets */
+
+extern const unsigned con_lat_buckets[CON_LAT_NBUCKETS];
+
+/* Data source transfers statistics, maintained by connectors */
+struct con_stats {
+	unsigned nxfers;		/* Successful transfers */
+	unsigned nretries;
+	unsigned ntimeouts;
+	unsigned nshort;		/* Short reads */
+	unsigned nresets;
+	unsigned lat_max;		/* Max transfer latency, us */
+	uint64_t lat_sum;		/* Total transfers latency, us */
+	/* Transfers per latency bucket, the last one is for slower ones */
+	unsigned lat_hist[CON_LAT_NBUCKETS + 1];
+};
+
+void con_stats_xfer(struct main_ctx *mc, unsigned lat);
+
 /* Main working context */
 struct main_ctx {
 	const struct connector_desc *con;	/* Selected connector */
+	const char *con_arg;			/* Connector argument */
 	void *con_priv;				/* Connector state */
 
+	const struct chip_desc *chip;		/* Chip preselected by connector */
+	const char *cache_dir;			/* EEPROM data cache directory */
+	const char *metrics_file;		/* Metrics export file */
+	const char *metrics_fields;		/* Exported fields patterns */
+
+	/* Device identification, filled by connector */
+	char dev_path[0x100];			/* Device location */
+	char dev_model[0x10];			/* Device model, e.g. VID:PID */
+	struct con_stats cs;			/* Transfers statistics */
+	unsigned nunknown;			/* Unknown chip IDs met */
+
 	uint8_t eep_buf[0x1000];		/* 4k buffer */
 	unsigned eep_len;			/* Actual EERPOM size */
+	unsigned eep_raw_len;			/* Size before normalization */
+	unsigned eep_norm;			/* Applied EEP_NORM_xxx fixes */
+
+	/* Lazy mode, connector fetches blocks on demand if eep_blk_sz != 0 */
+	unsigned eep_blk_sz;			/* Block size */
+	unsigned eep_xfer_max;			/* Max fetch size */
+	unsigned eep_ra;			/* Read-ahead size, blocks */
+	unsigned eep_next;			/* Next block of seq. access */
+	uint32_t eep_valid[0x1000 / EEP_BLK_SZ_MIN / 32]; /* Fetched blocks */
+	int eep_err;				/* Fetching error if any */
 };
 
 #endif	/* !_MTKEEPMGR_H_ */
@@ -35,5 +35,22 @@ static int rt5592_eep_parse(struct main_ctx *mc)
 	return 0;
 }
 
-CHIP(RT5592, 0x5592, rt5592_eep_parse);
-CHIP(MT7592, 0x7592, rt5592_eep_parse);
+static const struct eep_field rt5592_fields[] = {
+	EEP_FIELDS_COMMON,
+	EEP_FIELD("pci.dev_id", E_PCI_DEV_ID, 0xffff, .flags = EEP_FF_HEX),
+	EEP_FIELD("pci.ven_id", E_PCI_VEN_ID, 0xffff, .flags = EEP_FF_HEX),
+	EEP_FIELD("pci.sub_dev_id", E_PCI_SUB_DEV_ID, 0xffff, .flags = EEP_FF_HEX),
+	EEP_FIELD("pci.sub_ven_id", E_PCI_SUB_VEN_ID, 0xffff, .flags = EEP_FF_HEX),
+	{}
+};
+
+/* EEPROM ranges accessed by the parser */
+static const struct eep_range rt5592_plan[] = {
+	{E_CHIPID, E_PCI_SUB_VEN_ID + 2},
+	{}
+};
+
+CHIP(RT5592, 0x5592, rt5592_eep_parse, .plan = rt5592_plan,
+     .fields = rt5592_fields);
+CHIP(MT7592, 0x7592, rt5592_eep_parse, .plan = rt5592_plan,
+     .fields = rt5592_fields);
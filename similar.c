@@ -0,0 +1,444 @@
+/**
+ * Calibration similarity search
+ *
+ * Copyright (c) 2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Each image is described by a feature vector of decoded calibration
+ * fields (power tables, rate deltas, LNA gains, RSSI offsets, etc.). The
+ * vectors of a corpus are stored in an index file as a dense int16 matrix,
+ * so the search is a single linear pass with the squared Euclidean distance
+ * kernel, which the compiler vectorizes.
+ *
+ * Index file layout (native byte order):
+ *   magic "MTKEEPIX"
+ *   u16 chip ID, u16 vector dimension, u32 number of vectors
+ *   vectors, int16 each component
+ *   image names, NUL terminated strings
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mtkeepmgr.h"
+#include "field.h"
+#include "corpus.h"
+
+#define SIM_MAGIC		"MTKEEPIX"
+#define SIM_MAGIC_LEN		8
+#define SIM_HDR_LEN		16
+
+#define SIM_TOP_DEF		10
+#define SIM_TOP_MAX		1000
+
+
+struct sim_index {
+	uint16_t chipid;
+	unsigned dim;
+	unsigned n;
+	int16_t *vecs;			/* n x dim matrix */
+	const char **names;
+	void *map;			/* Mapped index file if any */
+	size_t mapsz;
+};
+
+/* Vector features of a chip */
+struct sim_features {
+	const struct chip_desc *chip;
+	const struct eep_field **fields;
+	unsigned dim;
+};
+
+static int sim_features_init(struct sim_features *sf,
+			     const struct chip_desc *chip)
+{
+	const struct eep_field *f;
+
+	sf->chip = chip;
+	sf->dim = 0;
+	for_each_field(chip, f)
+		sf->dim += field_is_calib(f);
+	if (!sf->dim) {
+		fprintf(stderr, "similar: %s chip has no calibration fields\n",
+			chip->name);
+		return -EINVAL;
+	}
+
+	sf->fields = calloc(sf->dim, sizeof(*sf->fields));
+	if (!sf->fields)
+		return -ENOMEM;
+
+	sf->dim = 0;
+	for_each_field(chip, f)
+		if (field_is_calib(f))
+			sf->fields[sf->dim++] = f;
+
+	return 0;
+}
+
+static void sim_vector(const struct sim_features *sf, struct main_ctx *mc,
+		       int16_t *v)
+{
+	unsigned i;
+
+	for (i = 0; i < sf->dim; ++i)
+		v[i] = field_value(mc, sf->fields[i]);
+}
+
+/* Squared Euclidean distance, kept as a plain loop to be vectorized */
+static uint32_t sim_dist(const int16_t *a, const int16_t *b, unsigned dim)
+{
+	uint32_t sum = 0;
+	unsigned i;
+
+	for (i = 0; i < dim; ++i)
+		sum += (int32_t)(a[i] - b[i]) * (a[i] - b[i]);
+
+	return sum;
+}
+
+static void sim_index_free(struct sim_index *si)
+{
+	if (si->map)
+		munmap(si->map, si->mapsz);
+	else
+		free(si->vecs);
+	free(si->names);
+}
+
+/* Map an index file, returns 1 if the file is not an index */
+static int sim_index_open(struct sim_index *si, const char *fname)
+{
+	const char *p, *e;
+	uint16_t dim;
+	uint32_t n;
+	uint8_t *hdr;
+	struct stat st;
+	unsigned i;
+	int fd;
+
+	memset(si, 0x00, sizeof(*si));
+
+	fd = open(fname, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) || !S_ISREG(st.st_mode) ||
+	    st.st_size < SIM_HDR_LEN) {
+		if (fd != -1)
+			close(fd);
+		return 1;
+	}
+
+	si->mapsz = st.st_size;
+	si->map = mmap(NULL, si->mapsz, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (si->map == MAP_FAILED) {
+		si->map = NULL;
+		return 1;
+	}
+
+	hdr = si->map;
+	if (memcmp(hdr, SIM_MAGIC, SIM_MAGIC_LEN) != 0) {
+		sim_index_free(si);
+		return 1;
+	}
+	memcpy(&si->chipid, hdr + 8, sizeof(si->chipid));
+	memcpy(&dim, hdr + 10, sizeof(dim));
+	memcpy(&n, hdr + 12, sizeof(n));
+	si->dim = dim;
+	si->n = n;
+	si->vecs = (int16_t *)(hdr + SIM_HDR_LEN);
+
+	e = (const char *)si->map + si->mapsz;
+	if ((size_t)si->n * si->dim * sizeof(*si->vecs) >
+	    si->mapsz - SIM_HDR_LEN)
+		goto corrupted;
+	p = (const char *)(si->vecs + (size_t)si->n * si->dim);
+	si->names = calloc(si->n ? : 1, sizeof(*si->names));
+	if (!si->names)
+		goto corrupted;
+	for (i = 0; i < si->n; ++i) {
+		si->names[i] = p;
+		p = memchr(p, '\0', e - p);
+		if (!p++)
+			goto corrupted;
+	}
+
+	return 0;
+
+corrupted:
+	fprintf(stderr, "similar: index '%s' is corrupted\n", fname);
+	sim_index_free(si);
+
+	return -EINVAL;
+}
+
+struct sim_build_ctx {
+	const struct sim_features *sf;
+	struct sim_index *si;
+	uint8_t *valid;
+};
+
+static int sim_build_image(struct main_ctx *mc, unsigned idx, unsigned tidx,
+			   void *priv)
+{
+	struct sim_build_ctx *bc = priv;
+
+	if (mc->eep_len < 2 ||
+	    eep_read_word(mc, E_CHIPID) != bc->sf->chip->chipid)
+		return -1;
+
+	sim_vector(bc->sf, mc, &bc->si->vecs[(size_t)idx * bc->sf->dim]);
+	bc->valid[idx] = 1;
+
+	return 0;
+}
+
+/* Compute vectors of the corpus images of the features chip */
+static int sim_index_build(struct sim_index *si, const struct sim_features *sf,
+			   struct corpus *c, long nthreads)
+{
+	struct sim_build_ctx bc = {.sf = sf, .si = si};
+	unsigned i, n;
+	int res;
+
+	memset(si, 0x00, sizeof(*si));
+	si->chipid = sf->chip->chipid;
+	si->dim = sf->dim;
+	si->vecs = calloc((size_t)c->nfiles * sf->dim, sizeof(*si->vecs));
+	si->names = calloc(c->nfiles, sizeof(*si->names));
+	bc.valid = calloc(c->nfiles, 1);
+	if (!si->vecs || !si->names || !bc.valid) {
+		res = -ENOMEM;
+		goto exit;
+	}
+
+	res = corpus_run(c, corpus_nthreads(c, nthreads), sim_build_image,
+			 &bc);
+	if (res < 0)
+		goto exit;
+
+	/* Compact the matrix by dropping skipped images */
+	for (i = 0, n = 0; i < c->nfiles; ++i) {
+		if (!bc.valid[i])
+			continue;
+		memmove(&si->vecs[(size_t)n * sf->dim],
+			&si->vecs[(size_t)i * sf->dim],
+			sf->dim * sizeof(*si->vecs));
+		si->names[n++] = c->files[i];
+	}
+	si->n = n;
+
+exit:
+	free(bc.valid);
+
+	return res;
+}
+
+static int sim_chip_load(struct main_ctx *mc, const char *fname,
+			 struct sim_features *sf)
+{
+	const struct chip_desc *chip;
+	int res;
+
+	res = corpus_load(mc, fname);
+	if (res)
+		return res;
+
+	chip = chip_find(eep_read_word(mc, E_CHIPID));
+	if (!chip) {
+		fprintf(stderr, "similar: '%s' is for unknown chip (chipid:0x%04x)\n",
+			fname, eep_read_word(mc, E_CHIPID));
+		return -EINVAL;
+	}
+
+	return sim_features_init(sf, chip);
+}
+
+int act_index(struct main_ctx *mc, int argc, char *argv[])
+{
+	const char *fname = argv[0];
+	struct sim_features sf = {0};
+	struct sim_index si = {0};
+	long nthreads = 0;
+	struct corpus c;
+	uint8_t hdr[SIM_HDR_LEN];
+	uint16_t val16;
+	uint32_t val32;
+	unsigned i;
+	FILE *fp;
+	int res;
+
+	for (argc--, argv++; argc && strncmp(argv[0], "threads=", 8) == 0;
+	     argc--, argv++)
+		nthreads = strtol(argv[0] + 8, NULL, 0);
+
+	res = corpus_init(&c, argc, argv);
+	if (res)
+		return res;
+
+	/* Index covers the chip of the first image */
+	res = sim_chip_load(mc, c.files[0], &sf);
+	if (res)
+		goto exit;
+	res = sim_index_build(&si, &sf, &c, nthreads);
+	if (res < 0)
+		goto exit;
+
+	fp = fopen(fname, "wb");
+	if (!fp) {
+		fprintf(stderr, "similar: unable to create '%s': %s\n", fname,
+			strerror(errno));
+		res = -errno;
+		goto exit;
+	}
+	memcpy(hdr, SIM_MAGIC, SIM_MAGIC_LEN);
+	val16 = si.chipid;
+	memcpy(hdr + 8, &val16, sizeof(val16));
+	val16 = si.dim;
+	memcpy(hdr + 10, &val16, sizeof(val16));
+	val32 = si.n;
+	memcpy(hdr + 12, &val32, sizeof(val32));
+	fwrite(hdr, sizeof(hdr), 1, fp);
+	fwrite(si.vecs, sizeof(*si.vecs) * si.dim, si.n, fp);
+	for (i = 0; i < si.n; ++i)
+		fwrite(si.names[i], strlen(si.names[i]) + 1, 1, fp);
+	if (ferror(fp) | fclose(fp)) {
+		fprintf(stderr, "similar: unable to write '%s'\n", fname);
+		res = -EIO;
+		goto exit;
+	}
+
+	printf("Indexed %u %s images (%u features), %u skipped\n", si.n,
+	       sf.chip->name, si.dim, c.nfiles - si.n);
+	res = 0;
+
+exit:
+	sim_index_free(&si);
+	free(sf.fields);
+	corpus_free(&c);
+
+	return res;
+}
+
+struct sim_hit {
+	uint32_t dist;
+	unsigned idx;
+};
+
+static void sim_search(const struct sim_index *si, const int16_t *q,
+		       struct sim_hit *top, unsigned *ntop, unsigned k)
+{
+	const int16_t *v = si->vecs;
+	unsigned i, j, n = 0;
+	uint32_t d;
+
+	for (i = 0; i < si->n; ++i, v += si->dim) {
+		d = sim_dist(q, v, si->dim);
+		if (n == k && d >= top[n - 1].dist)
+			continue;
+		/* Insertion into the sorted top list */
+		for (j = n < k ? n++ : n - 1; j && top[j - 1].dist > d; --j)
+			top[j] = top[j - 1];
+		top[j].dist = d;
+		top[j].idx = i;
+	}
+
+	*ntop = n;
+}
+
+int act_similar(struct main_ctx *mc, int argc, char *argv[])
+{
+	const char *fname = argv[0];
+	struct sim_features sf = {0};
+	struct sim_index si = {0};
+	struct corpus c = {0};
+	struct sim_hit *top = NULL;
+	unsigned k = SIM_TOP_DEF, ntop, i;
+	long nthreads = 0;
+	int16_t *q = NULL;
+	int res;
+
+	for (argc--, argv++; argc; argc--, argv++) {
+		if (strncmp(argv[0], "top=", 4) == 0)
+			k = strtoul(argv[0] + 4, NULL, 0);
+		else if (strncmp(argv[0], "threads=", 8) == 0)
+			nthreads = strtol(argv[0] + 8, NULL, 0);
+		else
+			break;
+	}
+	if (!k || k > SIM_TOP_MAX) {
+		fprintf(stderr, "similar: invalid number of results\n");
+		return -EINVAL;
+	}
+	if (!argc) {
+		fprintf(stderr, "similar: index or images are required\n");
+		return -EINVAL;
+	}
+
+	res = sim_chip_load(mc, fname, &sf);
+	if (res)
+		return res;
+	q = malloc(sf.dim * sizeof(*q));
+	top = calloc(k, sizeof(*top));
+	if (!q || !top) {
+		res = -ENOMEM;
+		goto exit;
+	}
+	sim_vector(&sf, mc, q);
+
+	/* Use the index if specified, otherwise scan the images */
+	res = argc == 1 ? sim_index_open(&si, argv[0]) : 1;
+	if (res < 0)
+		goto exit;
+	if (res) {
+		res = corpus_init(&c, argc, argv);
+		if (!res)
+			res = sim_index_build(&si, &sf, &c, nthreads);
+		if (res < 0)
+			goto exit;
+	} else if (si.chipid != sf.chip->chipid || si.dim != sf.dim) {
+		fprintf(stderr, "similar: index is for another chip or features set\n");
+		res = -EINVAL;
+		goto exit;
+	}
+
+	sim_search(&si, q, top, &ntop, k);
+
+	printf("Query: %s (%s), %u features, %u candidates\n", fname,
+	       sf.chip->name, sf.dim, si.n);
+	printf("%4s %8s  %s\n", "Rank", "Distance", "Image");
+	for (i = 0; i < ntop; ++i)
+		printf("%4u %8.1f  %s\n", i + 1, sqrt(top[i].dist),
+		       si.names[top[i].idx]);
+
+	res = 0;
+
+exit:
+	sim_index_free(&si);
+	corpus_free(&c);
+	free(top);
+	free(q);
+	free(sf.fields);
+
+	return res;
+}
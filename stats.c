@@ -0,0 +1,336 @@
+/**
+ * EEPROM fields statistics over a corpus of images
+ *
+ * Copyright (c) 2016-2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <math.h>
+
+#include "mtkeepmgr.h"
+#include "field.h"
+#include "corpus.h"
+
+#define STATS_NBINS		32
+#define STATS_NCHIPS		16	/* Max chips in a corpus */
+
+/* Mergeable per field accumulator */
+struct stats_acc {
+	unsigned long count;
+	int min, max;
+	double mean, m2;		/* Welford's running mean & M2 */
+	unsigned long hist[STATS_NBINS];
+};
+
+/* Histogram geometry of a field, which covers all possible values */
+struct stats_hist {
+	int lo;
+	unsigned width;			/* Bin width */
+	unsigned nbins;
+};
+
+struct stats_chip {
+	const struct chip_desc *chip;
+	unsigned long nunits;
+	unsigned nfields;
+	const struct eep_field **fields;	/* Selected fields */
+	struct stats_hist *hist;		/* Per field histogram geometry */
+	struct stats_acc *acc;			/* Per thread accumulators */
+};
+
+struct stats_ctx {
+	const char *pattern;
+	unsigned nthreads;
+	pthread_mutex_t lock;		/* Chips list protection */
+	struct stats_chip chips[STATS_NCHIPS];
+	unsigned nchips;
+};
+
+static int stats_field_match(const struct eep_field *f, const char *pattern)
+{
+	if (f->flags & (EEP_FF_HEX | EEP_FF_MACADDR))
+		return 0;		/* Not a quantity */
+
+	return fnmatch(pattern, f->name, 0) == 0;
+}
+
+/* Find the values domain of a field to build fixed bins histogram */
+static void stats_hist_init(const struct eep_field *f, struct stats_hist *h)
+{
+	unsigned width = __builtin_popcount(f->mask), raw, span;
+	int val, lo = 0, hi = 0;
+
+	for (raw = 0; raw < 1U << width; ++raw) {
+		val = field_decode(f, raw);
+		if (!raw || val < lo)
+			lo = val;
+		if (!raw || val > hi)
+			hi = val;
+	}
+
+	span = hi - lo + 1;
+	h->lo = lo;
+	h->width = (span + STATS_NBINS - 1) / STATS_NBINS;
+	h->nbins = (span + h->width - 1) / h->width;
+}
+
+/* Get or register corpus chip, called with the lock held */
+static struct stats_chip *stats_chip_get(struct stats_ctx *sc,
+					 const struct chip_desc *chip)
+{
+	const struct eep_field *f;
+	struct stats_chip *sch;
+	unsigned i, n = 0;
+
+	for (i = 0; i < sc->nchips; ++i)
+		if (sc->chips[i].chip == chip)
+			return &sc->chips[i];
+	if (sc->nchips == STATS_NCHIPS)
+		return NULL;
+
+	sch = &sc->chips[sc->nchips];
+	for_each_field(chip, f)
+		n += stats_field_match(f, sc->pattern);
+	sch->fields = calloc(n, sizeof(*sch->fields));
+	sch->hist = calloc(n, sizeof(*sch->hist));
+	sch->acc = calloc(n * sc->nthreads, sizeof(*sch->acc));
+	if (n && (!sch->fields || !sch->hist || !sch->acc)) {
+		free(sch->fields);
+		free(sch->hist);
+		free(sch->acc);
+		return NULL;
+	}
+
+	for_each_field(chip, f) {
+		if (!stats_field_match(f, sc->pattern))
+			continue;
+		stats_hist_init(f, &sch->hist[sch->nfields]);
+		sch->fields[sch->nfields++] = f;
+	}
+	sch->chip = chip;
+	sc->nchips++;
+
+	return sch;
+}
+
+static void stats_acc_add(struct stats_acc *a, const struct stats_hist *h,
+			  int val)
+{
+	double delta = val - a->mean;
+
+	if (!a->count || val < a->min)
+		a->min = val;
+	if (!a->count || val > a->max)
+		a->max = val;
+	a->count++;
+	a->mean += delta / a->count;
+	a->m2 += delta * (val - a->mean);
+	a->hist[(val - h->lo) / h->width]++;
+}
+
+/* Merge accumulators using the Chan et al. parallel algorithm */
+static void stats_acc_merge(struct stats_acc *a, const struct stats_acc *b)
+{
+	double delta = b->mean - a->mean;
+	unsigned long n = a->count + b->count;
+	unsigned i;
+
+	if (!b->count)
+		return;
+	if (!a->count) {
+		*a = *b;
+		return;
+	}
+
+	a->m2 += b->m2 + delta * delta * a->count * b->count / n;
+	a->mean += delta * b->count / n;
+	a->min = b->min < a->min ? b->min : a->min;
+	a->max = b->max > a->max ? b->max : a->max;
+	a->count = n;
+	for (i = 0; i < STATS_NBINS; ++i)
+		a->hist[i] += b->hist[i];
+}
+
+static int stats_image(struct main_ctx *mc, unsigned idx, unsigned tidx,
+		       void *priv)
+{
+	struct stats_ctx *sc = priv;
+	const struct chip_desc *chip;
+	struct stats_acc *acc;
+	struct stats_chip *sch;
+	unsigned i;
+
+	chip = chip_find(eep_read_word(mc, E_CHIPID));
+	if (!chip)
+		return -ENODEV;
+
+	pthread_mutex_lock(&sc->lock);
+	sch = stats_chip_get(sc, chip);
+	if (sch)
+		sch->nunits++;
+	pthread_mutex_unlock(&sc->lock);
+	if (!sch)
+		return -ENOMEM;
+
+	acc = &sch->acc[tidx * sch->nfields];
+	for (i = 0; i < sch->nfields; ++i)
+		stats_acc_add(&acc[i], &sch->hist[i],
+			      field_value(mc, sch->fields[i]));
+
+	return 0;
+}
+
+/* Scale of the field value to the output units */
+static double stats_scale(const struct eep_field *f)
+{
+	return f->flags & EEP_FF_HALF ? 0.5 : 1.0;
+}
+
+static void stats_print_text(const struct stats_chip *sch,
+			     const struct stats_acc *acc)
+{
+	const struct stats_hist *h;
+	const struct eep_field *f;
+	double k;
+	unsigned i, b;
+
+	printf("[%s, %lu units]\n", sch->chip->name, sch->nunits);
+	printf("  %-24s %7s %8s %8s %9s %9s  %s\n", "Field", "Count", "Min",
+	       "Max", "Mean", "StdDev", "Histogram (lo/width: bins)");
+	for (i = 0; i < sch->nfields; ++i) {
+		f = sch->fields[i];
+		h = &sch->hist[i];
+		k = stats_scale(f);
+		printf("  %-24s %7lu %8g %8g %9.3f %9.3f  %g/%g:", f->name,
+		       acc[i].count, acc[i].min * k, acc[i].max * k,
+		       acc[i].mean * k,
+		       acc[i].count > 1 ? sqrt(acc[i].m2 / (acc[i].count - 1)) * k : 0,
+		       h->lo * k, h->width * k);
+		for (b = 0; b < h->nbins; ++b)
+			printf(" %lu", acc[i].hist[b]);
+		printf("\n");
+	}
+	printf("\n");
+}
+
+static void stats_print_json(const struct stats_chip *sch,
+			     const struct stats_acc *acc, int last)
+{
+	const struct stats_hist *h;
+	const struct eep_field *f;
+	double k;
+	unsigned i, b;
+
+	printf("  {\"chip\": \"%s\", \"units\": %lu, \"fields\": [\n",
+	       sch->chip->name, sch->nunits);
+	for (i = 0; i < sch->nfields; ++i) {
+		f = sch->fields[i];
+		h = &sch->hist[i];
+		k = stats_scale(f);
+		printf("    {\"name\": \"%s\", \"count\": %lu, \"min\": %g, \"max\": %g, \"mean\": %g, \"stddev\": %g, ",
+		       f->name, acc[i].count, acc[i].min * k, acc[i].max * k,
+		       acc[i].mean * k,
+		       acc[i].count > 1 ? sqrt(acc[i].m2 / (acc[i].count - 1)) * k : 0);
+		printf("\"hist\": {\"lo\": %g, \"width\": %g, \"bins\": [",
+		       h->lo * k, h->width * k);
+		for (b = 0; b < h->nbins; ++b)
+			printf("%s%lu", b ? ", " : "", acc[i].hist[b]);
+		printf("]}}%s\n", i + 1 < sch->nfields ? "," : "");
+	}
+	printf("  ]}%s\n", last ? "" : ",");
+}
+
+/**
+ * Collect per field statistics over a corpus in a single pass. The corpus
+ * is streamed (directories are walked while images are processed) and each
+ * worker thread keeps own accumulators, which are merged at the end, so
+ * the memory usage does not depend on the corpus size.
+ *
+ * Arguments: [text|json] [fields=<pattern>] [threads=<n>] <image|dir>...
+ */
+int act_stats(struct main_ctx *mc, int argc, char *argv[])
+{
+	struct stats_chip *sch;
+	struct stats_ctx sc;
+	struct corpus c;
+	long nthreads = 0;
+	int json = 0, nskipped;
+	unsigned i, j, t;
+
+	memset(&sc, 0, sizeof(sc));
+	sc.pattern = "*";
+
+	for (; argc; --argc, ++argv) {
+		if (strcmp(argv[0], "text") == 0)
+			json = 0;
+		else if (strcmp(argv[0], "json") == 0)
+			json = 1;
+		else if (strncmp(argv[0], "fields=", 7) == 0)
+			sc.pattern = argv[0] + 7;
+		else if (strncmp(argv[0], "threads=", 8) == 0)
+			nthreads = strtol(argv[0] + 8, NULL, 0);
+		else
+			break;
+	}
+
+	nskipped = corpus_init_stream(&c, argc, argv);
+	if (nskipped)
+		return nskipped;
+
+	sc.nthreads = corpus_nthreads(&c, nthreads);
+	pthread_mutex_init(&sc.lock, NULL);
+
+	nskipped = corpus_run(&c, sc.nthreads, stats_image, &sc);
+	if (nskipped < 0)
+		goto exit;
+
+	if (json)
+		printf("{\"units\": %u, \"skipped\": %d, \"chips\": [\n",
+		       c.nfiles - nskipped, nskipped);
+	else
+		printf("Units: %u, skipped: %d\n\n", c.nfiles - nskipped,
+		       nskipped);
+
+	for (i = 0; i < sc.nchips; ++i) {
+		sch = &sc.chips[i];
+		for (t = 1; t < sc.nthreads; ++t)
+			for (j = 0; j < sch->nfields; ++j)
+				stats_acc_merge(&sch->acc[j],
+						&sch->acc[t * sch->nfields + j]);
+		if (json)
+			stats_print_json(sch, sch->acc, i + 1 == sc.nchips);
+		else
+			stats_print_text(sch, sch->acc);
+	}
+
+	if (json)
+		printf("]}\n");
+
+exit:
+	for (i = 0; i < sc.nchips; ++i) {
+		free(sc.chips[i].fields);
+		free(sc.chips[i].hist);
+		free(sc.chips[i].acc);
+	}
+	pthread_mutex_destroy(&sc.lock);
+	corpus_free(&c);
+
+	return nskipped < 0 ? nskipped : 0;
+}
@@ -0,0 +1,79 @@
+/**
+ * Static user space tracepoints
+ *
+ * Copyright (c) 2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+/**
+ * Tracepoints are USDT probes of the 'mtkeepmgr' provider. A probe is a
+ * single nop instruction plus a note in the ELF file, but its arguments are
+ * always evaluated. Each probe has a semaphore, which should be defined
+ * with TRACE_SEMAPHORE() in the file that uses the probe. A tracer (bpftrace,
+ * perf, etc.) increments the semaphore while attached, so TRACE_ACTIVE()
+ * could be used to skip a costly computation of tracepoint arguments.
+ * Without the sys/sdt.h header tracepoints are compiled out.
+ */
+#ifdef CONFIG_TRACE
+
+#define _SDT_HAS_SEMAPHORES	1
+#include <sys/sdt.h>
+
+#define TRACE_SEMAPHORE(__name)						\
+	unsigned short mtkeepmgr_##__name##_semaphore			\
+	__attribute__((used, section(".probes"), visibility("hidden")))
+#define TRACE_ACTIVE(__name)						\
+	__builtin_expect(*(volatile unsigned short *)			\
+			 &mtkeepmgr_##__name##_semaphore != 0, 0)
+
+#define TRACE0(__name)							\
+	DTRACE_PROBE(mtkeepmgr, __name)
+#define TRACE1(__name, __a1)						\
+	DTRACE_PROBE1(mtkeepmgr, __name, __a1)
+#define TRACE2(__name, __a1, __a2)					\
+	DTRACE_PROBE2(mtkeepmgr, __name, __a1, __a2)
+#define TRACE3(__name, __a1, __a2, __a3)				\
+	DTRACE_PROBE3(mtkeepmgr, __name, __a1, __a2, __a3)
+#define TRACE4(__name, __a1, __a2, __a3, __a4)				\
+	DTRACE_PROBE4(mtkeepmgr, __name, __a1, __a2, __a3, __a4)
+
+#else
+
+#define TRACE_SEMAPHORE(__name)						\
+	extern unsigned short mtkeepmgr_##__name##_semaphore
+#define TRACE_ACTIVE(__name)	0
+
+/* Keep arguments referenced to avoid unused variables warnings */
+#define TRACE0(__name)							\
+	do { } while (0)
+#define TRACE1(__name, __a1)						\
+	do { if (0) { (void)(__a1); } } while (0)
+#define TRACE2(__name, __a1, __a2)					\
+	do { if (0) { (void)(__a1); (void)(__a2); } } while (0)
+#define TRACE3(__name, __a1, __a2, __a3)				\
+	do { if (0) { (void)(__a1); (void)(__a2); (void)(__a3); } } while (0)
+#define TRACE4(__name, __a1, __a2, __a3, __a4)				\
+	do {								\
+		if (0) {						\
+			(void)(__a1); (void)(__a2);			\
+			(void)(__a3); (void)(__a4);			\
+		}							\
+	} while (0)
+
+#endif	/* CONFIG_TRACE */
+
+#endif	/* !_TRACE_H_ */
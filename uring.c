@@ -0,0 +1,211 @@
+/**
+ * Minimal io_uring implementation
+ *
+ * Copyright (c) 2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+int uring_init(struct uring *r, unsigned entries)
+{
+	struct io_uring_params p;
+
+	memset(r, 0x00, sizeof(*r));
+	memset(&p, 0x00, sizeof(p));
+
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0)
+		return -errno;
+
+	r->sq_entries = p.sq_entries;
+	r->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_ring_sz = p.cq_off.cqes +
+			p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_ring_sz > r->sq_ring_sz)
+			r->sq_ring_sz = r->cq_ring_sz;
+		r->cq_ring_sz = 0;
+	}
+
+	r->sq_ring = mmap(NULL, r->sq_ring_sz, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ring == MAP_FAILED)
+		goto err;
+	if (r->cq_ring_sz) {
+		r->cq_ring = mmap(NULL, r->cq_ring_sz, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_POPULATE, r->fd,
+				  IORING_OFF_CQ_RING);
+		if (r->cq_ring == MAP_FAILED) {
+			r->cq_ring = NULL;
+			goto err;
+		}
+	} else {
+		r->cq_ring = r->sq_ring;
+	}
+	r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		goto err;
+	}
+
+	r->ksq_head = (void *)((char *)r->sq_ring + p.sq_off.head);
+	r->ksq_tail = (void *)((char *)r->sq_ring + p.sq_off.tail);
+	r->ksq_mask = (void *)((char *)r->sq_ring + p.sq_off.ring_mask);
+	r->ksq_array = (void *)((char *)r->sq_ring + p.sq_off.array);
+	r->kcq_head = (void *)((char *)r->cq_ring + p.cq_off.head);
+	r->kcq_tail = (void *)((char *)r->cq_ring + p.cq_off.tail);
+	r->kcq_mask = (void *)((char *)r->cq_ring + p.cq_off.ring_mask);
+	r->cqes = (void *)((char *)r->cq_ring + p.cq_off.cqes);
+	r->sq_tail = *r->ksq_tail;
+
+	return 0;
+
+err:
+	if (r->sq_ring == MAP_FAILED)
+		r->sq_ring = NULL;
+	uring_free(r);
+
+	return -ENOMEM;
+}
+
+void uring_free(struct uring *r)
+{
+	if (r->sqes)
+		munmap(r->sqes, r->sqes_sz);
+	if (r->cq_ring && r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_sz);
+	if (r->sq_ring)
+		munmap(r->sq_ring, r->sq_ring_sz);
+	close(r->fd);
+	memset(r, 0x00, sizeof(*r));
+	r->fd = -1;
+}
+
+/* Check that the kernel supports all the specified operations */
+int uring_probe(struct uring *r, const uint8_t *ops, unsigned nops)
+{
+	struct io_uring_probe *probe;
+	unsigned i;
+	int res;
+
+	probe = calloc(1, sizeof(*probe) +
+			  IORING_OP_LAST * sizeof(probe->ops[0]));
+	if (!probe)
+		return -ENOMEM;
+
+	res = syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE,
+		      probe, IORING_OP_LAST);
+	if (res < 0) {
+		res = -errno;
+		goto exit;
+	}
+
+	for (i = 0; i < nops; ++i) {
+		if (ops[i] >= probe->ops_len ||
+		    !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+			res = -EOPNOTSUPP;
+			goto exit;
+		}
+	}
+
+exit:
+	free(probe);
+
+	return res;
+}
+
+int uring_register_buffers(struct uring *r, const struct iovec *iov,
+			   unsigned n)
+{
+	if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS,
+		    iov, n) < 0)
+		return -errno;
+
+	return 0;
+}
+
+/* Number of free SQEs */
+unsigned uring_sq_space(struct uring *r)
+{
+	unsigned head = __atomic_load_n(r->ksq_head, __ATOMIC_ACQUIRE);
+
+	return r->sq_entries - (r->sq_tail - head);
+}
+
+/* Get a free SQE or NULL if the SQ is full */
+struct io_uring_sqe *uring_get_sqe(struct uring *r)
+{
+	unsigned head = __atomic_load_n(r->ksq_head, __ATOMIC_ACQUIRE);
+	unsigned idx = r->sq_tail & *r->ksq_mask;
+
+	if (r->sq_tail - head >= r->sq_entries)
+		return NULL;
+
+	r->ksq_array[idx] = idx;
+	r->sq_tail++;
+	r->sq_pending++;
+	memset(&r->sqes[idx], 0x00, sizeof(r->sqes[idx]));
+
+	return &r->sqes[idx];
+}
+
+/**
+ * Submit queued SQEs and wait for at least min_complete completions with a
+ * single system call.
+ */
+int uring_submit_wait(struct uring *r, unsigned min_complete)
+{
+	int res;
+
+	__atomic_store_n(r->ksq_tail, r->sq_tail, __ATOMIC_RELEASE);
+
+	do {
+		res = syscall(__NR_io_uring_enter, r->fd, r->sq_pending,
+			      min_complete,
+			      min_complete ? IORING_ENTER_GETEVENTS : 0,
+			      NULL, 0);
+	} while (res < 0 && errno == EINTR);
+	if (res < 0)
+		return -errno;
+
+	r->sq_pending -= res;
+
+	return 0;
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *r)
+{
+	unsigned head = *r->kcq_head;
+
+	if (head == __atomic_load_n(r->kcq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return &r->cqes[head & *r->kcq_mask];
+}
+
+void uring_cqe_seen(struct uring *r)
+{
+	__atomic_store_n(r->kcq_head, *r->kcq_head + 1, __ATOMIC_RELEASE);
+}
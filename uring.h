@@ -0,0 +1,56 @@
+/**
+ * Minimal io_uring interface
+ *
+ * Copyright (c) 2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _URING_H_
+#define _URING_H_
+
+/**
+ * Thin io_uring wrapper on top of the raw system calls, so no liburing is
+ * required. Each ring is used by a single thread only.
+ */
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <linux/io_uring.h>
+
+struct uring {
+	int fd;
+	unsigned sq_entries;
+	unsigned sq_tail;		/* Local SQ tail */
+	unsigned sq_pending;		/* Queued but not submitted SQEs */
+	unsigned *ksq_head, *ksq_tail, *ksq_mask, *ksq_array;
+	unsigned *kcq_head, *kcq_tail, *kcq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_sz, cq_ring_sz, sqes_sz;
+};
+
+int uring_init(struct uring *r, unsigned entries);
+void uring_free(struct uring *r);
+int uring_probe(struct uring *r, const uint8_t *ops, unsigned nops);
+int uring_register_buffers(struct uring *r, const struct iovec *iov,
+			   unsigned n);
+unsigned uring_sq_space(struct uring *r);
+struct io_uring_sqe *uring_get_sqe(struct uring *r);
+int uring_submit_wait(struct uring *r, unsigned min_complete);
+struct io_uring_cqe *uring_peek_cqe(struct uring *r);
+void uring_cqe_seen(struct uring *r);
+
+#endif	/* !_URING_H_ */
@@ -0,0 +1,230 @@
+/**
+ * USB devices database
+ *
+ * Copyright (c) 2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "mtkeepmgr.h"
+#include "usbdb.h"
+
+/* Built-in devices, could be extended or overridden by an external file */
+static const struct {
+	uint16_t vid;
+	uint16_t pid;
+	uint16_t chipid;
+	unsigned eep_sz;
+	unsigned xfer_sz;
+} builtin[] = {
+	{0x148f, 0x7610, 0x7610, 0x200, 0x20},	/* Default ID of MT7610U */
+	{0x148f, 0x761a, 0x7610, 0x200, 0x20},	/* TP-Link T2U dongle */
+};
+
+/* Open addressing hash table, a zero VID/PID pair marks an empty slot */
+static struct usbdb_entry *tbl;
+static unsigned tbl_sz;			/* Always a power of two */
+static unsigned tbl_used;
+
+static unsigned usbdb_hash(uint16_t vid, uint16_t pid)
+{
+	return (((uint32_t)vid << 16 | pid) * 0x9e3779b1) >> 16;
+}
+
+static struct usbdb_entry *usbdb_slot(struct usbdb_entry *t, unsigned sz,
+				      uint16_t vid, uint16_t pid)
+{
+	unsigned i = usbdb_hash(vid, pid) & (sz - 1);
+
+	while (t[i].vid || t[i].pid) {
+		if (t[i].vid == vid && t[i].pid == pid)
+			break;
+		i = (i + 1) & (sz - 1);
+	}
+
+	return &t[i];
+}
+
+static int usbdb_grow(void)
+{
+	unsigned i, sz = tbl_sz ? tbl_sz * 2 : 0x20;
+	struct usbdb_entry *t, *e;
+
+	t = calloc(sz, sizeof(*t));
+	if (!t)
+		return -ENOMEM;
+
+	for (i = 0; i < tbl_sz; ++i) {
+		if (!tbl[i].vid && !tbl[i].pid)
+			continue;
+		e = usbdb_slot(t, sz, tbl[i].vid, tbl[i].pid);
+		*e = tbl[i];
+	}
+
+	free(tbl);
+	tbl = t;
+	tbl_sz = sz;
+
+	return 0;
+}
+
+static int usbdb_add(const struct usbdb_entry *ent)
+{
+	struct usbdb_entry *e;
+
+	if ((tbl_used + 1) * 2 > tbl_sz && usbdb_grow())
+		return -ENOMEM;
+
+	e = usbdb_slot(tbl, tbl_sz, ent->vid, ent->pid);
+	if (!e->vid && !e->pid)
+		tbl_used++;
+	*e = *ent;
+
+	return 0;
+}
+
+static int usbdb_init(void)
+{
+	struct usbdb_entry ent;
+	int i, res;
+
+	if (tbl)
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(builtin); ++i) {
+		ent.vid = builtin[i].vid;
+		ent.pid = builtin[i].pid;
+		ent.chip = chip_find(builtin[i].chipid);
+		ent.eep_sz = builtin[i].eep_sz;
+		ent.xfer_sz = builtin[i].xfer_sz;
+		res = usbdb_add(&ent);
+		if (res)
+			return res;
+	}
+
+	return 0;
+}
+
+static int usbdb_parse_size(const char *str, unsigned *val)
+{
+	unsigned long v;
+	char *end;
+
+	if (strcmp(str, "-") == 0) {
+		*val = 0;
+		return 0;
+	}
+
+	v = strtoul(str, &end, 0);
+	if (end == str || *end != '\0' || v % 2 != 0 || v > 0xffff)
+		return -1;
+	*val = v;
+
+	return 0;
+}
+
+/**
+ * Load devices database file. Each line of the file describes one device:
+ *
+ *   <VID>:<PID> <chip> <eepsize> <xfersize>
+ *
+ * Where <chip> is a chip name (e.g. MT7610), <eepsize> is the EEPROM size
+ * and <xfersize> is the maximum safe size of a single EEPROM read transfer.
+ * Any of the last three fields could be specified as '-' if unknown. Text
+ * after the '#' symbol is ignored.
+ */
+int usbdb_load(const char *fname)
+{
+	char line[0x100], chip[0x20], eep_sz[0x10], xfer_sz[0x10], *p;
+	struct usbdb_entry ent;
+	unsigned vid, pid;
+	int lineno = 0, ret;
+	FILE *fp;
+
+	ret = usbdb_init();
+	if (ret)
+		return ret;
+
+	fp = fopen(fname, "r");
+	if (!fp) {
+		ret = errno;
+		fprintf(stderr, "usbdb: unable to open devices database '%s': %s\n",
+			fname, strerror(ret));
+		return -ret;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		p = strchr(line, '#');
+		if (p)
+			*p = '\0';
+		if (sscanf(line, " %c", chip) != 1)	/* Empty line */
+			continue;
+
+		if (sscanf(line, "%x:%x %31s %15s %15s", &vid, &pid, chip,
+			   eep_sz, xfer_sz) != 5 || vid > 0xffff ||
+		    pid > 0xffff || (!vid && !pid)) {
+			fprintf(stderr, "usbdb: %s:%d: unable to parse device entry\n",
+				fname, lineno);
+			ret = -EINVAL;
+			break;
+		}
+
+		ent.vid = vid;
+		ent.pid = pid;
+		if (strcmp(chip, "-") == 0) {
+			ent.chip = NULL;
+		} else {
+			ent.chip = chip_find_by_name(chip);
+			if (!ent.chip) {
+				fprintf(stderr, "usbdb: %s:%d: unknown chip -- %s\n",
+					fname, lineno, chip);
+				ret = -EINVAL;
+				break;
+			}
+		}
+		if (usbdb_parse_size(eep_sz, &ent.eep_sz) ||
+		    usbdb_parse_size(xfer_sz, &ent.xfer_sz)) {
+			fprintf(stderr, "usbdb: %s:%d: invalid EEPROM or transfer size\n",
+				fname, lineno);
+			ret = -EINVAL;
+			break;
+		}
+
+		ret = usbdb_add(&ent);
+		if (ret)
+			break;
+	}
+
+	fclose(fp);
+
+	return ret;
+}
+
+const struct usbdb_entry *usbdb_lookup(uint16_t vid, uint16_t pid)
+{
+	const struct usbdb_entry *e;
+
+	if (usbdb_init())
+		return NULL;
+
+	e = usbdb_slot(tbl, tbl_sz, vid, pid);
+
+	return e->vid || e->pid ? e : NULL;
+}
@@ -0,0 +1,33 @@
+/**
+ * USB devices database
+ *
+ * Copyright (c) 2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _USBDB_H_
+#define _USBDB_H_
+
+struct usbdb_entry {
+	uint16_t vid;
+	uint16_t pid;
+	const struct chip_desc *chip;	/* Chip, NULL if unknown */
+	unsigned eep_sz;		/* EEPROM size, 0 if unknown */
+	unsigned xfer_sz;		/* Max safe transfer size, 0 if unknown */
+};
+
+int usbdb_load(const char *fname);
+const struct usbdb_entry *usbdb_lookup(uint16_t vid, uint16_t pid);
+
+#endif	/* !_USBDB_H_ */
@@ -0,0 +1,553 @@
+/**
+ * Native usbfs USB backend
+ *
+ * Copyright (c) 2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <sys/ioctl.h>
+
+#include "mtkeepmgr.h"
+#include "usbfs.h"
+
+#define USBFS_SYSFS_DEVICES	"/sys/bus/usb/devices"
+#define USBFS_DEV_ROOT		"/dev/bus/usb"
+
+#define USBFS_PATH_MAX		16	/* Max ports path length */
+#define USBFS_DEV_DESC_SZ	18
+
+#define USB_REQ_GET_DESCRIPTOR	0x06
+#define USB_DT_STRING		0x03
+
+struct libusb_context {
+	struct libusb_transfer *pending;	/* Submitted transfers */
+};
+
+struct libusb_device {
+	libusb_context *ctx;
+	uint8_t busnum;
+	uint8_t devaddr;
+	int plen;			/* Path length, -1 if too long */
+	uint8_t path[USBFS_PATH_MAX];
+	struct libusb_device_descriptor desc;
+};
+
+struct libusb_device_handle {
+	libusb_context *ctx;
+	int fd;
+};
+
+static int usbfs_err(int err)
+{
+	switch (err) {
+	case EACCES:
+	case EPERM:
+		return LIBUSB_ERROR_ACCESS;
+	case ENOENT:
+	case ENODEV:
+	case ESHUTDOWN:
+		return LIBUSB_ERROR_NO_DEVICE;
+	case ETIMEDOUT:
+		return LIBUSB_ERROR_TIMEOUT;
+	case EPIPE:
+		return LIBUSB_ERROR_PIPE;
+	case EOVERFLOW:
+		return LIBUSB_ERROR_OVERFLOW;
+	case EBUSY:
+		return LIBUSB_ERROR_BUSY;
+	case ENOMEM:
+		return LIBUSB_ERROR_NO_MEM;
+	case EINTR:
+		return LIBUSB_ERROR_INTERRUPTED;
+	case EINVAL:
+		return LIBUSB_ERROR_INVALID_PARAM;
+	default:
+		return LIBUSB_ERROR_IO;
+	}
+}
+
+static uint64_t usbfs_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int libusb_init(libusb_context **ctx)
+{
+	*ctx = calloc(1, sizeof(**ctx));
+
+	return *ctx ? LIBUSB_SUCCESS : LIBUSB_ERROR_NO_MEM;
+}
+
+void libusb_exit(libusb_context *ctx)
+{
+	free(ctx);
+}
+
+static int usbfs_read_attr(const char *dev, const char *attr, void *buf,
+			   size_t bufsz)
+{
+	char path[0x100];
+	int fd, res;
+
+	snprintf(path, sizeof(path), USBFS_SYSFS_DEVICES "/%s/%s", dev, attr);
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	res = read(fd, buf, bufsz);
+	close(fd);
+
+	return res;
+}
+
+static int usbfs_read_num(const char *dev, const char *attr, unsigned *val)
+{
+	char buf[0x10], *end;
+	int res;
+
+	res = usbfs_read_attr(dev, attr, buf, sizeof(buf) - 1);
+	if (res <= 0)
+		return -1;
+	buf[res] = '\0';
+	*val = strtoul(buf, &end, 10);
+
+	return end == buf ? -1 : 0;
+}
+
+/**
+ * Build a device from a sysfs entry. The device descriptor is read from the
+ * 'descriptors' attribute, which the kernel serves from its own copy, so
+ * the device is not accessed during the enumeration.
+ */
+static int usbfs_dev_fill(libusb_device *dev, const char *name)
+{
+	uint8_t d[USBFS_DEV_DESC_SZ];
+	const char *p;
+	unsigned v;
+	char *end;
+
+	if (strchr(name, ':'))
+		return -1;		/* Interface */
+
+	if (usbfs_read_num(name, "busnum", &v) || v > 0xff)
+		return -1;
+	dev->busnum = v;
+	if (usbfs_read_num(name, "devnum", &v) || v > 0x7f)
+		return -1;
+	dev->devaddr = v;
+
+	/* Ports path, e.g. 3-1.2 (root hubs are named usbN) */
+	dev->plen = 0;
+	p = strchr(name, '-');
+	while (p && strncmp(name, "usb", 3) != 0) {
+		v = strtoul(p + 1, &end, 10);
+		if (end == p + 1 || v > 0xff)
+			return -1;
+		if (dev->plen >= 0 && dev->plen < USBFS_PATH_MAX)
+			dev->path[dev->plen++] = v;
+		else
+			dev->plen = -1;
+		p = *end == '.' ? end : NULL;
+	}
+
+	if (usbfs_read_attr(name, "descriptors", d, sizeof(d)) != sizeof(d))
+		return -1;
+	dev->desc.bLength = d[0];
+	dev->desc.bDescriptorType = d[1];
+	dev->desc.bcdUSB = d[2] | d[3] << 8;
+	dev->desc.bDeviceClass = d[4];
+	dev->desc.bDeviceSubClass = d[5];
+	dev->desc.bDeviceProtocol = d[6];
+	dev->desc.bMaxPacketSize0 = d[7];
+	dev->desc.idVendor = d[8] | d[9] << 8;
+	dev->desc.idProduct = d[10] | d[11] << 8;
+	dev->desc.bcdDevice = d[12] | d[13] << 8;
+	dev->desc.iManufacturer = d[14];
+	dev->desc.iProduct = d[15];
+	dev->desc.iSerialNumber = d[16];
+	dev->desc.bNumConfigurations = d[17];
+
+	return 0;
+}
+
+ssize_t libusb_get_device_list(libusb_context *ctx, libusb_device ***list)
+{
+	libusb_device **devs = NULL, **tmp, *dev;
+	struct dirent *de;
+	ssize_t n = 0;
+	DIR *dir;
+
+	dir = opendir(USBFS_SYSFS_DEVICES);
+	if (!dir)
+		return usbfs_err(errno);
+
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		dev = calloc(1, sizeof(*dev));
+		if (!dev)
+			goto err;
+		if (usbfs_dev_fill(dev, de->d_name)) {
+			free(dev);
+			continue;
+		}
+		dev->ctx = ctx;
+
+		tmp = realloc(devs, (n + 2) * sizeof(*devs));
+		if (!tmp) {
+			free(dev);
+			goto err;
+		}
+		devs = tmp;
+		devs[n++] = dev;
+	}
+	closedir(dir);
+
+	if (!devs) {
+		devs = calloc(1, sizeof(*devs));
+		if (!devs)
+			return LIBUSB_ERROR_NO_MEM;
+	}
+	devs[n] = NULL;
+	*list = devs;
+
+	return n;
+
+err:
+	closedir(dir);
+	if (devs) {
+		devs[n] = NULL;
+		libusb_free_device_list(devs, 1);
+	}
+
+	return LIBUSB_ERROR_NO_MEM;
+}
+
+void libusb_free_device_list(libusb_device **list, int unref_devices)
+{
+	libusb_device **dev;
+
+	for (dev = list; *dev; ++dev)
+		free(*dev);
+	free(list);
+}
+
+int libusb_get_device_descriptor(libusb_device *dev,
+				 struct libusb_device_descriptor *desc)
+{
+	*desc = dev->desc;
+
+	return LIBUSB_SUCCESS;
+}
+
+uint8_t libusb_get_bus_number(libusb_device *dev)
+{
+	return dev->busnum;
+}
+
+uint8_t libusb_get_device_address(libusb_device *dev)
+{
+	return dev->devaddr;
+}
+
+int libusb_get_port_numbers(libusb_device *dev, uint8_t *port_numbers,
+			    int port_numbers_len)
+{
+	if (dev->plen < 0 || dev->plen > port_numbers_len)
+		return LIBUSB_ERROR_OVERFLOW;
+	memcpy(port_numbers, dev->path, dev->plen);
+
+	return dev->plen;
+}
+
+int libusb_open(libusb_device *dev, libusb_device_handle **dev_handle)
+{
+	libusb_device_handle *h;
+	char path[0x40];
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return LIBUSB_ERROR_NO_MEM;
+
+	snprintf(path, sizeof(path), USBFS_DEV_ROOT "/%03u/%03u", dev->busnum,
+		 dev->devaddr);
+	h->fd = open(path, O_RDWR | O_CLOEXEC);
+	if (h->fd == -1) {
+		free(h);
+		return usbfs_err(errno);
+	}
+	h->ctx = dev->ctx;
+	*dev_handle = h;
+
+	return LIBUSB_SUCCESS;
+}
+
+void libusb_close(libusb_device_handle *dev_handle)
+{
+	close(dev_handle->fd);
+	free(dev_handle);
+}
+
+int libusb_reset_device(libusb_device_handle *dev_handle)
+{
+	if (ioctl(dev_handle->fd, USBDEVFS_RESET, NULL) < 0)
+		return usbfs_err(errno);
+
+	return LIBUSB_SUCCESS;
+}
+
+int libusb_control_transfer(libusb_device_handle *dev_handle,
+			    uint8_t request_type, uint8_t bRequest,
+			    uint16_t wValue, uint16_t wIndex,
+			    unsigned char *data, uint16_t wLength,
+			    unsigned int timeout)
+{
+	struct usbdevfs_ctrltransfer ctrl = {
+		.bRequestType = request_type,
+		.bRequest = bRequest,
+		.wValue = wValue,
+		.wIndex = wIndex,
+		.wLength = wLength,
+		.timeout = timeout,
+		.data = data,
+	};
+	int res;
+
+	res = ioctl(dev_handle->fd, USBDEVFS_CONTROL, &ctrl);
+	if (res < 0)
+		return usbfs_err(errno);
+
+	return res;
+}
+
+int libusb_get_string_descriptor_ascii(libusb_device_handle *dev_handle,
+				       uint8_t desc_index, unsigned char *data,
+				       int length)
+{
+	unsigned char tbuf[0xff];
+	unsigned langid;
+	int res, si, di;
+
+	if (!desc_index)
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	/* Use the first supported language */
+	res = libusb_control_transfer(dev_handle, LIBUSB_ENDPOINT_IN,
+				      USB_REQ_GET_DESCRIPTOR, USB_DT_STRING << 8,
+				      0, tbuf, sizeof(tbuf), 1000);
+	if (res < 0)
+		return res;
+	if (res < 4)
+		return LIBUSB_ERROR_IO;
+	langid = tbuf[2] | tbuf[3] << 8;
+
+	res = libusb_control_transfer(dev_handle, LIBUSB_ENDPOINT_IN,
+				      USB_REQ_GET_DESCRIPTOR,
+				      USB_DT_STRING << 8 | desc_index, langid,
+				      tbuf, sizeof(tbuf), 1000);
+	if (res < 0)
+		return res;
+	if (res < 2 || tbuf[1] != USB_DT_STRING || tbuf[0] > res)
+		return LIBUSB_ERROR_IO;
+
+	/* UTF-16LE to ASCII, non-ASCII symbols are replaced */
+	for (di = 0, si = 2; si + 1 < tbuf[0] && di < length - 1; si += 2)
+		data[di++] = tbuf[si + 1] || tbuf[si] & 0x80 ? '?' : tbuf[si];
+	data[di] = '\0';
+
+	return di;
+}
+
+struct libusb_transfer *libusb_alloc_transfer(int iso_packets)
+{
+	return calloc(1, sizeof(struct libusb_transfer));
+}
+
+void libusb_free_transfer(struct libusb_transfer *transfer)
+{
+	if (!transfer)
+		return;
+	if (transfer->flags & LIBUSB_TRANSFER_FREE_BUFFER)
+		free(transfer->buffer);
+	free(transfer);
+}
+
+/**
+ * Submit a control transfer as an URB, so several transfers (e.g. to
+ * different devices) are processed by the host controller in parallel.
+ */
+int libusb_submit_transfer(struct libusb_transfer *transfer)
+{
+	libusb_context *ctx = transfer->dev_handle->ctx;
+	struct usbdevfs_urb *urb = &transfer->urb;
+
+	memset(urb, 0x00, sizeof(*urb));
+	urb->type = USBDEVFS_URB_TYPE_CONTROL;
+	urb->endpoint = 0;
+	urb->buffer = transfer->buffer;
+	urb->buffer_length = transfer->length;
+	urb->usercontext = transfer;
+
+	if (ioctl(transfer->dev_handle->fd, USBDEVFS_SUBMITURB, urb) < 0)
+		return usbfs_err(errno);
+
+	transfer->deadline = transfer->timeout ?
+			     usbfs_time_us() + transfer->timeout * 1000ULL : 0;
+	transfer->discarded = 0;
+	transfer->next = ctx->pending;
+	ctx->pending = transfer;
+
+	return LIBUSB_SUCCESS;
+}
+
+static enum libusb_transfer_status usbfs_urb_status(struct libusb_transfer *t)
+{
+	switch (t->urb.status) {
+	case 0:
+		return LIBUSB_TRANSFER_COMPLETED;
+	case -ENOENT:
+	case -ECONNRESET:
+		return t->discarded ? LIBUSB_TRANSFER_TIMED_OUT :
+				      LIBUSB_TRANSFER_CANCELLED;
+	case -EPIPE:
+		return LIBUSB_TRANSFER_STALL;
+	case -ENODEV:
+	case -ESHUTDOWN:
+		return LIBUSB_TRANSFER_NO_DEVICE;
+	case -EOVERFLOW:
+		return LIBUSB_TRANSFER_OVERFLOW;
+	default:
+		return LIBUSB_TRANSFER_ERROR;
+	}
+}
+
+/* Reap completed URBs of the device and run the transfers callbacks */
+static void usbfs_reap(libusb_context *ctx, int fd)
+{
+	struct libusb_transfer *t, **pp;
+	struct usbdevfs_urb *urb;
+
+	while (ioctl(fd, USBDEVFS_REAPURBNDELAY, &urb) == 0) {
+		t = urb->usercontext;
+		for (pp = &ctx->pending; *pp && *pp != t; pp = &(*pp)->next);
+		if (*pp)
+			*pp = t->next;
+		t->status = usbfs_urb_status(t);
+		t->actual_length = urb->actual_length;
+		t->callback(t);
+	}
+}
+
+int libusb_handle_events_completed(libusb_context *ctx, int *completed)
+{
+	struct libusb_transfer *t;
+	struct pollfd *fds;
+	uint64_t now, next = 0;
+	int i, n = 0, timeout = -1, res;
+
+	for (t = ctx->pending; t; t = t->next)
+		n++;
+	if (!n)
+		return LIBUSB_SUCCESS;
+
+	fds = calloc(n, sizeof(*fds));
+	if (!fds)
+		return LIBUSB_ERROR_NO_MEM;
+
+	/* usbfs signals URB completion as the fd writability */
+	for (i = 0, t = ctx->pending; t; t = t->next, ++i) {
+		fds[i].fd = t->dev_handle->fd;
+		fds[i].events = POLLOUT;
+		if (t->deadline && !t->discarded &&
+		    (!next || t->deadline < next))
+			next = t->deadline;
+	}
+	if (next) {
+		now = usbfs_time_us();
+		timeout = next > now ? (next - now + 999) / 1000 : 0;
+	}
+
+	res = poll(fds, n, timeout);
+	if (res < 0) {
+		res = usbfs_err(errno);
+		goto exit;
+	}
+
+	for (i = 0; i < n; ++i)
+		if (fds[i].revents)
+			usbfs_reap(ctx, fds[i].fd);
+
+	/* Discard expired URBs, they are reaped on the next call */
+	now = usbfs_time_us();
+	for (t = ctx->pending; t; t = t->next) {
+		if (!t->deadline || t->discarded || t->deadline > now)
+			continue;
+		t->discarded = 1;
+		ioctl(t->dev_handle->fd, USBDEVFS_DISCARDURB, &t->urb);
+	}
+
+	res = LIBUSB_SUCCESS;
+
+exit:
+	free(fds);
+
+	return res;
+}
+
+const char *libusb_strerror(int errcode)
+{
+	switch (errcode) {
+	case LIBUSB_SUCCESS:
+		return "Success";
+	case LIBUSB_ERROR_IO:
+		return "Input/Output Error";
+	case LIBUSB_ERROR_INVALID_PARAM:
+		return "Invalid parameter";
+	case LIBUSB_ERROR_ACCESS:
+		return "Access denied (insufficient permissions)";
+	case LIBUSB_ERROR_NO_DEVICE:
+		return "No such device (it may have been disconnected)";
+	case LIBUSB_ERROR_NOT_FOUND:
+		return "Entity not found";
+	case LIBUSB_ERROR_BUSY:
+		return "Resource busy";
+	case LIBUSB_ERROR_TIMEOUT:
+		return "Operation timed out";
+	case LIBUSB_ERROR_OVERFLOW:
+		return "Overflow";
+	case LIBUSB_ERROR_PIPE:
+		return "Pipe error";
+	case LIBUSB_ERROR_INTERRUPTED:
+		return "System call interrupted";
+	case LIBUSB_ERROR_NO_MEM:
+		return "Insufficient memory";
+	case LIBUSB_ERROR_NOT_SUPPORTED:
+		return "Operation not supported or unimplemented on this platform";
+	default:
+		return "Other error";
+	}
+}
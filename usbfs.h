@@ -0,0 +1,193 @@
+/**
+ * Native usbfs USB backend interface
+ *
+ * Copyright (c) 2021, Sergey Ryazanov <ryazanov.s.a@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _USBFS_H_
+#define _USBFS_H_
+
+/**
+ * The backend implements the subset of the libusb-1.0 API, which is used by
+ * the USB connector, on top of the Linux usbfs (/dev/bus/usb/BBB/DDD) and
+ * sysfs, so the connector code is the same for both backends. Devices are
+ * enumerated via sysfs and are opened only on demand.
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <linux/usbdevice_fs.h>
+
+#define LIBUSB_CONTROL_SETUP_SIZE	8
+
+enum libusb_endpoint_direction {
+	LIBUSB_ENDPOINT_IN = 0x80,
+	LIBUSB_ENDPOINT_OUT = 0x00,
+};
+
+enum libusb_request_type {
+	LIBUSB_REQUEST_TYPE_STANDARD = 0x00 << 5,
+	LIBUSB_REQUEST_TYPE_VENDOR = 0x02 << 5,
+};
+
+enum libusb_request_recipient {
+	LIBUSB_RECIPIENT_DEVICE = 0x00,
+};
+
+enum libusb_error {
+	LIBUSB_SUCCESS = 0,
+	LIBUSB_ERROR_IO = -1,
+	LIBUSB_ERROR_INVALID_PARAM = -2,
+	LIBUSB_ERROR_ACCESS = -3,
+	LIBUSB_ERROR_NO_DEVICE = -4,
+	LIBUSB_ERROR_NOT_FOUND = -5,
+	LIBUSB_ERROR_BUSY = -6,
+	LIBUSB_ERROR_TIMEOUT = -7,
+	LIBUSB_ERROR_OVERFLOW = -8,
+	LIBUSB_ERROR_PIPE = -9,
+	LIBUSB_ERROR_INTERRUPTED = -10,
+	LIBUSB_ERROR_NO_MEM = -11,
+	LIBUSB_ERROR_NOT_SUPPORTED = -12,
+	LIBUSB_ERROR_OTHER = -99,
+};
+
+enum libusb_transfer_status {
+	LIBUSB_TRANSFER_COMPLETED,
+	LIBUSB_TRANSFER_ERROR,
+	LIBUSB_TRANSFER_TIMED_OUT,
+	LIBUSB_TRANSFER_CANCELLED,
+	LIBUSB_TRANSFER_STALL,
+	LIBUSB_TRANSFER_NO_DEVICE,
+	LIBUSB_TRANSFER_OVERFLOW,
+};
+
+enum libusb_transfer_flags {
+	LIBUSB_TRANSFER_FREE_BUFFER = 1 << 1,
+};
+
+struct libusb_device_descriptor {
+	uint8_t bLength;
+	uint8_t bDescriptorType;
+	uint16_t bcdUSB;
+	uint8_t bDeviceClass;
+	uint8_t bDeviceSubClass;
+	uint8_t bDeviceProtocol;
+	uint8_t bMaxPacketSize0;
+	uint16_t idVendor;
+	uint16_t idProduct;
+	uint16_t bcdDevice;
+	uint8_t iManufacturer;
+	uint8_t iProduct;
+	uint8_t iSerialNumber;
+	uint8_t bNumConfigurations;
+};
+
+typedef struct libusb_context libusb_context;
+typedef struct libusb_device libusb_device;
+typedef struct libusb_device_handle libusb_device_handle;
+
+struct libusb_transfer;
+
+typedef void (*libusb_transfer_cb_fn)(struct libusb_transfer *transfer);
+
+struct libusb_transfer {
+	libusb_device_handle *dev_handle;
+	uint8_t flags;
+	unsigned int timeout;		/* ms, 0 - no timeout */
+	enum libusb_transfer_status status;
+	int length;
+	int actual_length;
+	libusb_transfer_cb_fn callback;
+	void *user_data;
+	unsigned char *buffer;
+
+	/* Backend private part */
+	struct usbdevfs_urb urb;
+	uint64_t deadline;		/* Timeout moment, us */
+	int discarded;
+	struct libusb_transfer *next;	/* Pending transfers list */
+};
+
+int libusb_init(libusb_context **ctx);
+void libusb_exit(libusb_context *ctx);
+
+ssize_t libusb_get_device_list(libusb_context *ctx, libusb_device ***list);
+void libusb_free_device_list(libusb_device **list, int unref_devices);
+int libusb_get_device_descriptor(libusb_device *dev,
+				 struct libusb_device_descriptor *desc);
+uint8_t libusb_get_bus_number(libusb_device *dev);
+uint8_t libusb_get_device_address(libusb_device *dev);
+int libusb_get_port_numbers(libusb_device *dev, uint8_t *port_numbers,
+			    int port_numbers_len);
+
+int libusb_open(libusb_device *dev, libusb_device_handle **dev_handle);
+void libusb_close(libusb_device_handle *dev_handle);
+int libusb_reset_device(libusb_device_handle *dev_handle);
+
+int libusb_control_transfer(libusb_device_handle *dev_handle,
+			    uint8_t request_type, uint8_t bRequest,
+			    uint16_t wValue, uint16_t wIndex,
+			    unsigned char *data, uint16_t wLength,
+			    unsigned int timeout);
+int libusb_get_string_descriptor_ascii(libusb_device_handle *dev_handle,
+				       uint8_t desc_index, unsigned char *data,
+				       int length);
+
+struct libusb_transfer *libusb_alloc_transfer(int iso_packets);
+void libusb_free_transfer(struct libusb_transfer *transfer);
+int libusb_submit_transfer(struct libusb_transfer *transfer);
+int libusb_handle_events_completed(libusb_context *ctx, int *completed);
+
+const char *libusb_strerror(int errcode);
+
+static inline void libusb_fill_control_setup(unsigned char *buf,
+					     uint8_t bmRequestType,
+					     uint8_t bRequest, uint16_t wValue,
+					     uint16_t wIndex, uint16_t wLength)
+{
+	buf[0] = bmRequestType;
+	buf[1] = bRequest;
+	buf[2] = wValue;
+	buf[3] = wValue >> 8;
+	buf[4] = wIndex;
+	buf[5] = wIndex >> 8;
+	buf[6] = wLength;
+	buf[7] = wLength >> 8;
+}
+
+static inline void libusb_fill_control_transfer(struct libusb_transfer *transfer,
+						libusb_device_handle *dev_handle,
+						unsigned char *buffer,
+						libusb_transfer_cb_fn callback,
+						void *user_data,
+						unsigned int timeout)
+{
+	transfer->dev_handle = dev_handle;
+	transfer->buffer = buffer;
+	transfer->length = LIBUSB_CONTROL_SETUP_SIZE +
+			   (buffer[6] | buffer[7] << 8);
+	transfer->callback = callback;
+	transfer->user_data = user_data;
+	transfer->timeout = timeout;
+}
+
+static inline unsigned char *
+libusb_control_transfer_get_data(struct libusb_transfer *transfer)
+{
+	return transfer->buffer + LIBUSB_CONTROL_SETUP_SIZE;
+}
+
+#endif	/* !_USBFS_H_ */
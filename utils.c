@@ -62,3 +62,18 @@ void hexdump_print(const uint8_t *buf, unsigned int len, unsigned int flags)
 		printf("|\n");
 	}
 }
+
+/**
+ * Render a value specified in 0.5 units (e.g. 0.5 dBm) as a fixed-point
+ * decimal without the floating point formatting.
+ */
+char *half_str(char *buf, size_t bufsz, int val, unsigned flags)
+{
+	unsigned absval = val < 0 ? -val : val;
+
+	snprintf(buf, bufsz, "%s%u.%u",
+		 val < 0 ? "-" : flags & HALF_F_PLUS ? "+" : "",
+		 absval / 2, absval % 2 * 5);
+
+	return buf;
+}
@@ -25,4 +25,8 @@ const char *get_macaddr_str(struct main_ctx *mc);
 
 void hexdump_print(const uint8_t *buf, unsigned int len, unsigned int flags);
 
+#define HALF_F_PLUS		0x0001	/* Print the plus sign too */
+
+char *half_str(char *buf, size_t bufsz, int val, unsigned flags);
+
 #endif	/* !_UTILS_H_ */